@@ -0,0 +1,204 @@
+#include "BinaryWire.h"
+#include "Log.h"
+#include <climits>
+
+static const char acknowledgement_type[] = "ACK";
+
+static void put_u16(char *out, uint16_t value) {
+    out[0] = static_cast<char>(value & 0xff);
+    out[1] = static_cast<char>(value >> 8);
+}
+
+static void put_u32(char *out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+void put_i16(char *out, int16_t value) {
+    put_u16(out, static_cast<uint16_t>(value));
+}
+
+void put_i32(char *out, int32_t value) {
+    put_u32(out, static_cast<uint32_t>(value));
+}
+
+void put_i32(std::string &out, int32_t value) {
+    char bytes[4];
+    put_i32(bytes, value);
+    out.append(bytes, 4);
+}
+
+void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void put_path_hop(std::string &out, ushort previous, ushort port) {
+    // Zigzag, so small steps down are as short as small steps up
+    long delta = static_cast<long>(port) - static_cast<long>(previous);
+    put_varint(out, delta < 0 ? static_cast<uint64_t>(-delta) * 2 - 1 : static_cast<uint64_t>(delta) * 2);
+}
+
+void put_binary_header(std::string &out, BinaryKind kind, unsigned long time, ushort to_port, ushort from_port,
+                       short ttl, short flags, int location, int sequence_number, size_t path_count) {
+    char header[WIRE_BINARY_HEADER_SIZE];
+    header[0] = static_cast<char>(WIRE_BINARY_MAGIC);
+    header[1] = static_cast<char>(WIRE_BINARY_VERSION);
+    header[2] = static_cast<char>(kind);
+    put_i16(header + 3, flags);
+    put_i16(header + WIRE_BINARY_TTL_OFFSET, ttl);
+    put_u16(header + 7, to_port);
+    put_u16(header + 9, from_port);
+    put_i32(header + WIRE_BINARY_LOCATION_OFFSET, location);
+    put_i32(header + 15, sequence_number);
+    put_u32(header + 19, static_cast<uint32_t>(time));
+    header[WIRE_BINARY_PATH_COUNT_OFFSET] = static_cast<char>(path_count);
+    out.append(header, WIRE_BINARY_HEADER_SIZE);
+}
+
+static uint16_t get_u16(const unsigned char *in) {
+    return static_cast<uint16_t>(in[0] | (in[1] << 8));
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+    return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) |
+           (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+static bool get_varint(const unsigned char *data, size_t length, size_t &i, uint64_t &out) {
+    out = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (i == length) return false;
+        unsigned char byte = data[i++];
+        out |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+size_t envelope_entry_size(size_t length) {
+    size_t size = 1;
+    for (size_t value = length; value >= 0x80; value >>= 7) ++size;
+    return size + length;
+}
+
+void put_envelope_entry(std::string &out, const char *data, size_t length) {
+    put_varint(out, length);
+    out.append(data, length);
+}
+
+bool EnvelopeReader::next(const char *&packet, size_t &packet_length) {
+    if (broken || position >= length) return false;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    uint64_t value;
+    if (!get_varint(bytes, length, position, value) || value == 0 || value > length - position) {
+        broken = true;
+        return false;
+    }
+    packet = data + position;
+    packet_length = static_cast<size_t>(value);
+    position += packet_length;
+    return true;
+}
+
+bool parse_binary_wire(const char *data, size_t length, WireFields &fields) {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    fields.present = 0;
+    fields.msg = FieldView();
+    fields.type = FieldView();
+    fields.send_path_length = 0;
+    fields.sack = 0;
+    fields.source = FieldView(data, length);
+    fields.binary = true;
+    for (int k = 0; k < KEY_COUNT; ++k) fields.raw[k] = FieldView();
+
+    if (length < WIRE_BINARY_HEADER_SIZE) {
+        LOG_WARN("Binary datagram is shorter than its header");
+        return false;
+    }
+    if (bytes[1] != WIRE_BINARY_VERSION) {
+        LOG_WARN("Binary version " << static_cast<int>(bytes[1]) << " is not supported");
+        return false;
+    }
+    fields.version = bytes[1];
+    fields.flags = static_cast<short>(static_cast<int16_t>(get_u16(bytes + 3)));
+    fields.ttl = static_cast<short>(static_cast<int16_t>(get_u16(bytes + WIRE_BINARY_TTL_OFFSET)));
+    fields.to_port = get_u16(bytes + 7);
+    fields.from_port = get_u16(bytes + 9);
+    fields.location = static_cast<int32_t>(get_u32(bytes + WIRE_BINARY_LOCATION_OFFSET));
+    fields.sequence_number = static_cast<int32_t>(get_u32(bytes + 15));
+    fields.time = get_u32(bytes + 19);
+    size_t path_count = bytes[WIRE_BINARY_PATH_COUNT_OFFSET];
+    fields.present = (1u << KEY_TIME) | (1u << KEY_TO_PORT) | (1u << KEY_FROM_PORT) | (1u << KEY_TTL) |
+                     (1u << KEY_VERSION) | (1u << KEY_FLAGS) | (1u << KEY_LOCATION) | (1u << KEY_SEQUENCE_NUMBER);
+
+    size_t i = WIRE_BINARY_HEADER_SIZE;
+    uint64_t value;
+    switch (bytes[2]) {
+        case BINARY_KIND_MESSAGE:
+            if (!get_varint(bytes, length, i, value) || value > length - i) {
+                LOG_WARN("msg has an invalid value");
+                return false;
+            }
+            fields.msg = FieldView(data + i, static_cast<size_t>(value));
+            fields.present |= 1u << KEY_MSG;
+            i += static_cast<size_t>(value);
+            break;
+        case BINARY_KIND_ACKNOWLEDGEMENT:
+            fields.type = FieldView(acknowledgement_type, sizeof(acknowledgement_type) - 1);
+            fields.present |= 1u << KEY_TYPE;
+            if (!get_varint(bytes, length, i, value) || value > static_cast<uint64_t>(INT_MAX) + 1) {
+                LOG_WARN("cum_ack has an invalid value");
+                return false;
+            }
+            if (value == 0) break;
+            fields.cumulative_ack = static_cast<int>(value - 1);
+            fields.present |= 1u << KEY_CUMULATIVE_ACK;
+            if (!get_varint(bytes, length, i, fields.sack)) {
+                LOG_WARN("sack has an invalid value");
+                return false;
+            }
+            fields.present |= 1u << KEY_SACK;
+            break;
+        case BINARY_KIND_MOVE:
+            if (length - i < 4 || path_count != 0) {
+                LOG_WARN("move has an invalid value");
+                return false;
+            }
+            fields.move = static_cast<int32_t>(get_u32(bytes + i));
+            fields.present |= 1u << KEY_MOVE;
+            i += 4;
+            break;
+        default:
+            LOG_WARN("Binary packet kind " << static_cast<int>(bytes[2]) << " is not in protocol");
+            return false;
+    }
+
+    if (bytes[2] != BINARY_KIND_MOVE) {
+        if (path_count > WIRE_MAX_SEND_PATH) {
+            LOG_WARN("send-path has an invalid value");
+            return false;
+        }
+        long previous = fields.from_port;
+        for (size_t hop = 0; hop < path_count; ++hop) {
+            long port = -1;
+            if (get_varint(bytes, length, i, value) && value <= 2 * 0xffff) {
+                port = previous + (value & 1 ? -static_cast<long>((value + 1) / 2) : static_cast<long>(value / 2));
+            }
+            if (port < 0 || port > 0xffff) {
+                LOG_WARN("send-path has an invalid value");
+                return false;
+            }
+            fields.send_path[fields.send_path_length++] = static_cast<ushort>(port);
+            previous = port;
+        }
+        fields.present |= 1u << KEY_SEND_PATH;
+    }
+    if (i != length) {
+        LOG_WARN("Binary datagram has " << length - i << " trailing byte(s)");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef BINARY_WIRE_H
+#define BINARY_WIRE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "WireParser.h"
+
+// Compact encoding used by packets whose version field is WIRE_BINARY_VERSION. Text datagrams
+// always start with a key name, so the magic byte is enough to tell the two apart.
+//
+// Fixed little-endian header:
+//   0  magic           u8
+//   1  version         u8
+//   2  kind            u8   (BinaryKind)
+//   3  flags           u16  (every bit of the packets' short flags field)
+//   5  ttl             i16
+//   7  to_port         u16
+//   9  from_port       u16
+//   11 location        i32
+//   15 sequence_number i32
+//   19 time            u32  (seconds; good until 2106)
+//   23 path count      u8
+// followed by the kind's body and then the send path, one zigzag varint per hop holding the
+// difference from the previous hop (from_port for the first), so the nearby ports of one swarm
+// take a byte per hop instead of three. Bodies:
+//   message: varint length + bytes
+//   ack:     varint (cumulative ack + 1, 0 when absent), then varint selective bitmap if present
+//   move:    i32 target location
+// The path goes last so a relay appends its hop without moving anything else.
+#define WIRE_BINARY_MAGIC 0xB5
+#define WIRE_BINARY_VERSION 10
+#define WIRE_BINARY_HEADER_SIZE 24
+#define WIRE_BINARY_TTL_OFFSET 5
+#define WIRE_BINARY_LOCATION_OFFSET 11
+#define WIRE_BINARY_PATH_COUNT_OFFSET 23
+
+enum BinaryKind {
+    BINARY_KIND_MESSAGE = 0,
+    BINARY_KIND_ACKNOWLEDGEMENT = 1,
+    BINARY_KIND_MOVE = 2
+};
+
+inline bool is_binary_wire(const char *data, size_t length) {
+    return length > 0 && static_cast<unsigned char>(data[0]) == WIRE_BINARY_MAGIC;
+}
+
+// Envelope: several packets for the same destination in one datagram. After the magic byte
+// each packet, text or binary, follows as a varint length and its bytes. Envelopes do not nest.
+#define WIRE_ENVELOPE_MAGIC 0xB6
+
+inline bool is_envelope(const char *data, size_t length) {
+    return length > 0 && static_cast<unsigned char>(data[0]) == WIRE_ENVELOPE_MAGIC;
+}
+
+// Bytes a packet of this length adds to an envelope
+size_t envelope_entry_size(size_t length);
+
+void put_envelope_entry(std::string &out, const char *data, size_t length);
+
+// Walks the packets of an envelope without copying them
+class EnvelopeReader {
+public:
+    EnvelopeReader(const char *data, size_t length) : data(data), length(length), position(1), broken(false) {}
+
+    // The next packet; false at the end or when the rest is malformed
+    bool next(const char *&packet, size_t &packet_length);
+
+    // Stopped at a malformed entry rather than at the end
+    bool malformed() const { return broken; }
+
+private:
+    const char *data;
+    size_t length;
+    size_t position;
+    bool broken;
+};
+
+void put_binary_header(std::string &out, BinaryKind kind, unsigned long time, ushort to_port, ushort from_port,
+                       short ttl, short flags, int location, int sequence_number, size_t path_count);
+
+void put_varint(std::string &out, uint64_t value);
+
+// Appends one send-path hop; previous is the hop before it, or from_port for the first
+void put_path_hop(std::string &out, ushort previous, ushort port);
+
+void put_i16(char *out, int16_t value);
+
+void put_i32(char *out, int32_t value);
+
+void put_i32(std::string &out, int32_t value);
+
+// Fills fields the same way parse_wire does for the equivalent text datagram; raw[] stays
+// empty because there is no text to point into
+bool parse_binary_wire(const char *data, size_t length, WireFields &fields);
+
+#endif // BINARY_WIRE_H
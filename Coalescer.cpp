@@ -0,0 +1,78 @@
+#include "Coalescer.h"
+#include "BinaryWire.h"
+#include "Metrics.h"
+
+Coalescer::Coalescer(int send_file_descriptor, size_t budget, const SendOffload &next)
+        : budget(budget), next(next), batch(send_file_descriptor, SEND_BATCH_CAPACITY, true) {}
+
+Coalescer::Envelope &Coalescer::envelope_for(const sockaddr_in &address) {
+    uint64_t key = (static_cast<uint64_t>(address.sin_addr.s_addr) << 16) | address.sin_port;
+    auto found = index.find(key);
+    if (found != index.end()) return envelopes[found->second];
+    index[key] = envelopes.size();
+    envelopes.push_back(Envelope());
+    Envelope &envelope = envelopes.back();
+    envelope.address = address;
+    envelope.packets = 0;
+    return envelope;
+}
+
+void Coalescer::emit(const sockaddr_in &address, const char *data, size_t length) {
+    if (next) {
+        staging.payload.assign(data, length);
+        staging.destinations.assign(1, address);
+        if (next(staging)) return;
+    }
+    batch.add(address, data, length);
+}
+
+void Coalescer::emit(Envelope &envelope) {
+    if (envelope.packets == 1) {
+        // Nothing to share the datagram with, so send the packet as it is
+        const char *packet;
+        size_t length;
+        EnvelopeReader reader(envelope.data.data(), envelope.data.size());
+        reader.next(packet, length);
+        emit(envelope.address, packet, length);
+    } else {
+        emit(envelope.address, envelope.data.data(), envelope.data.size());
+        metrics_add(COUNTER_ENVELOPES);
+        metrics_add(COUNTER_COALESCED, envelope.packets);
+    }
+    envelope.packets = 0;
+}
+
+bool Coalescer::add(OutgoingDatagrams &datagrams) {
+    const std::string &payload = datagrams.payload;
+    size_t entry = envelope_entry_size(payload.size());
+    // The batch references envelope buffers and addresses, so anything emitted here is flushed
+    // before that buffer is refilled or the envelope list grows
+    for (const sockaddr_in &destination: datagrams.destinations) {
+        Envelope &envelope = envelope_for(destination);
+        if (envelope.packets > 0 && envelope.data.size() + entry > budget) {
+            emit(envelope);
+            batch.flush();
+        }
+        if (1 + entry > budget) {
+            // Too large to share an envelope with anything
+            emit(destination, payload.data(), payload.size());
+            batch.flush();
+            continue;
+        }
+        if (envelope.packets == 0) envelope.data.assign(1, static_cast<char>(WIRE_ENVELOPE_MAGIC));
+        put_envelope_entry(envelope.data, payload.data(), payload.size());
+        ++envelope.packets;
+    }
+    return true;
+}
+
+size_t Coalescer::flush() {
+    size_t emitted = 0;
+    for (Envelope &envelope: envelopes) {
+        if (envelope.packets == 0) continue;
+        emit(envelope);
+        ++emitted;
+    }
+    batch.flush();
+    return emitted;
+}
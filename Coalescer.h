@@ -0,0 +1,55 @@
+#ifndef COALESCER_H
+#define COALESCER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Transport.h"
+
+// Packs outgoing packets for the same destination into envelope datagrams (see BinaryWire.h).
+// Installed as the send offload, it takes every datagram a SendBatch would have sent and holds
+// it in its destination's envelope until flush() or until the next packet would take the
+// envelope past budget bytes. An envelope that ends up holding one packet goes out as that
+// plain packet. Not thread-safe: only the thread that sends may use it.
+class Coalescer {
+public:
+    // Envelopes go to next when it is set and accepts them (e.g. the pipeline's send thread),
+    // otherwise straight to the kernel through send_file_descriptor
+    Coalescer(int send_file_descriptor, size_t budget, const SendOffload &next = SendOffload());
+
+    // Takes the datagrams over; always succeeds
+    bool add(OutgoingDatagrams &datagrams);
+
+    // Sends every envelope held; returns the number of datagrams that went out
+    size_t flush();
+
+private:
+    struct Envelope {
+        sockaddr_in address;
+        std::string data;
+        size_t packets;
+    };
+
+    size_t budget;
+    SendOffload next;
+    SendBatch batch;
+    OutgoingDatagrams staging;
+    std::vector<Envelope> envelopes; // One per destination seen, kept so their buffers are reused
+    std::unordered_map<uint64_t, size_t> index; // Address and port to envelopes[]
+
+    Envelope &envelope_for(const sockaddr_in &address);
+
+    // Queues one envelope's datagram on batch, or hands it to next
+    void emit(Envelope &envelope);
+
+    void emit(const sockaddr_in &address, const char *data, size_t length);
+
+    Coalescer(const Coalescer &) = delete;
+
+    Coalescer &operator=(const Coalescer &) = delete;
+};
+
+#endif // COALESCER_H
@@ -0,0 +1,179 @@
+#include "CommandChannel.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+
+#define COMMAND_BURST_MS 20 // Commands a rate allows to bunch up while nobody asks for them
+
+static bool parse_port(const std::string &word, ushort &port) {
+    if (word.empty() || word.find_first_not_of("0123456789") != std::string::npos || word.size() > 5) return false;
+    unsigned long value = std::strtoul(word.c_str(), nullptr, 10);
+    if (value == 0 || value > 65535) return false;
+    port = static_cast<ushort>(value);
+    return true;
+}
+
+static bool parse_int(const std::string &word, int &value) {
+    if (word.empty()) return false;
+    char *end;
+    errno = 0;
+    long parsed = std::strtol(word.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0' || parsed < -0x7fffffffL || parsed > 0x7fffffffL) return false;
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+// Splits off the next whitespace-delimited word of line from position; position ends up at the
+// start of whatever follows it
+static std::string next_word(const std::string &line, size_t &position) {
+    size_t start = line.find_first_not_of(" \t", position);
+    if (start == std::string::npos) {
+        position = line.size();
+        return std::string();
+    }
+    size_t end = line.find_first_of(" \t", start);
+    if (end == std::string::npos) end = line.size();
+    position = end;
+    return line.substr(start, end - start);
+}
+
+CommandChannel::CommandChannel(int file_descriptor, uint64_t rate, bool prompts, uint64_t now_ms)
+        : file_descriptor(file_descriptor), prompts(prompts), at_end(false), entry(Entry::Idle), entry_port(0),
+          rate(rate), tokens(1), refilled_ms(now_ms), resume_ms(0) {}
+
+size_t CommandChannel::fill() {
+    if (at_end) return 0;
+    pollfd ready{file_descriptor, POLLIN, 0};
+    if (poll(&ready, 1, 0) <= 0 || ready.revents == 0) return 0;
+    char buffer[COMMAND_READ_CHUNK];
+    ssize_t length = read(file_descriptor, buffer, sizeof(buffer));
+    if (length < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    if (length <= 0) {
+        at_end = true;
+        if (!partial.empty()) parse_line(std::move(partial));
+        partial.clear();
+        return 0;
+    }
+    partial.append(buffer, static_cast<size_t>(length));
+    size_t start = 0, end;
+    while ((end = partial.find('\n', start)) != std::string::npos) {
+        parse_line(partial.substr(start, end - start));
+        start = end + 1;
+    }
+    partial.erase(0, start);
+    return static_cast<size_t>(length);
+}
+
+void CommandChannel::push(CommandKind kind, ushort port, int location, const std::string &text) {
+    Queued queued;
+    queued.command.kind = kind;
+    queued.command.port = port;
+    queued.command.location = location;
+    queued.command.text = text;
+    queued.wait = false;
+    queued.wait_ms = 0;
+    commands.push_back(std::move(queued));
+}
+
+void CommandChannel::parse_line(std::string line) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+
+    // Second and third lines of the two-step entry are taken as typed
+    if (entry == Entry::Message) {
+        if (line.empty()) {
+            entry = Entry::Location;
+            if (prompts) std::cout << "Moving drone..." << std::endl << "Enter New Location:" << std::endl;
+            return;
+        }
+        entry = Entry::Idle;
+        push(CommandKind::Send, entry_port, 0, line);
+        return;
+    }
+    if (entry == Entry::Location) {
+        entry = Entry::Idle;
+        size_t position = 0;
+        int location;
+        if (!parse_int(next_word(line, position), location)) {
+            invalid("Invalid location: " + line);
+            return;
+        }
+        push(CommandKind::Move, entry_port, location, std::string());
+        return;
+    }
+
+    size_t position = 0;
+    std::string verb = next_word(line, position);
+    if (verb.empty() || verb[0] == '#') return;
+    ushort port;
+    if (parse_port(verb, port) && next_word(line, position).empty()) {
+        entry = Entry::Message;
+        entry_port = port;
+        if (prompts) std::cout << "Enter message: " << std::flush;
+        return;
+    }
+    if (verb == "send") {
+        if (!parse_port(next_word(line, position), port)) {
+            invalid("Usage: send <port> <message>");
+            return;
+        }
+        // The message is the rest of the line, inner spacing kept
+        size_t start = line.find_first_not_of(" \t", position);
+        if (start == std::string::npos) {
+            invalid("Usage: send <port> <message>");
+            return;
+        }
+        push(CommandKind::Send, port, 0, line.substr(start));
+    } else if (verb == "move") {
+        int location;
+        if (!parse_port(next_word(line, position), port) || !parse_int(next_word(line, position), location)) {
+            invalid("Usage: move <port> <location>");
+            return;
+        }
+        push(CommandKind::Move, port, location, std::string());
+    } else if (verb == "stats") {
+        push(CommandKind::Stats, 0, 0, std::string());
+    } else if (verb == "wait") {
+        int milliseconds;
+        if (!parse_int(next_word(line, position), milliseconds) || milliseconds < 0) {
+            invalid("Usage: wait <ms>");
+            return;
+        }
+        Queued queued;
+        queued.command.kind = CommandKind::Invalid;
+        queued.wait = true;
+        queued.wait_ms = static_cast<uint64_t>(milliseconds);
+        commands.push_back(std::move(queued));
+    } else {
+        invalid("Unknown command: " + verb +
+                " (send <port> <message>, move <port> <location>, stats, wait <ms>)");
+    }
+}
+
+bool CommandChannel::next(Command &command, uint64_t now_ms) {
+    if (rate > 0) {
+        double burst = std::max(1.0, static_cast<double>(rate) * COMMAND_BURST_MS / 1000);
+        tokens = std::min(burst,
+                          tokens + static_cast<double>(now_ms - refilled_ms) * static_cast<double>(rate) / 1000);
+        refilled_ms = now_ms;
+    }
+    while (!commands.empty()) {
+        if (now_ms < resume_ms) return false;
+        Queued &front = commands.front();
+        if (front.wait) {
+            resume_ms = now_ms + front.wait_ms;
+            commands.pop_front();
+            continue;
+        }
+        if (rate > 0) {
+            if (tokens < 1) return false;
+            tokens -= 1;
+        }
+        command = std::move(front.command);
+        commands.pop_front();
+        return true;
+    }
+    return false;
+}
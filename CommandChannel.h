@@ -0,0 +1,97 @@
+#ifndef COMMAND_CHANNEL_H
+#define COMMAND_CHANNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+typedef unsigned short ushort;
+
+#define COMMAND_READ_CHUNK 4096
+#define COMMAND_BACKLOG_LIMIT 1024 // Parsed commands a channel holds before it stops reading
+
+enum class CommandKind {
+    Send,    // send <port> <message>
+    Move,    // move <port> <location>
+    Stats,   // stats
+    Invalid  // text says what was wrong
+};
+
+struct Command {
+    CommandKind kind;
+    ushort port;
+    int location;
+    std::string text;
+};
+
+// Operator or script input for drone3, one command per line:
+//
+//   send <port> <message>     message is the rest of the line
+//   move <port> <location>
+//   stats
+//   wait <ms>                 hold the commands after it back this long
+//   # ...                     comment; blank lines are ignored too
+//
+// The original two-step entry still works: a line with just a port starts it, the next line is
+// the message, and an empty message asks for a location and moves that drone instead.
+//
+// Reading never blocks (it only takes what poll reports as ready), so a half-typed command or
+// a slow pipe cannot stall the drone. Commands come out of next() no faster than the rate.
+class CommandChannel {
+public:
+    // rate is in commands per second, 0 for no limit; prompts are printed for the two-step entry
+    CommandChannel(int file_descriptor, uint64_t rate, bool prompts, uint64_t now_ms);
+
+    // Reads what is ready, at most COMMAND_READ_CHUNK bytes, and parses every complete line.
+    // Returns the number of bytes read: 0 when nothing was ready or the input has ended, in which
+    // case any last unterminated line has been parsed too.
+    size_t fill();
+
+    // The next command due at now_ms, if any
+    bool next(Command &command, uint64_t now_ms);
+
+    int descriptor() const { return file_descriptor; }
+
+    size_t backlog() const { return commands.size(); }
+
+    bool full() const { return commands.size() >= COMMAND_BACKLOG_LIMIT; }
+
+    bool ended() const { return at_end; }
+
+    // Input has ended and every command in it has been handed out
+    bool finished() const { return at_end && commands.empty(); }
+
+private:
+    enum class Entry { Idle, Message, Location }; // Where the two-step entry is
+
+    struct Queued {
+        Command command;
+        bool wait;        // A wait line: nothing to run, the commands after it are held back
+        uint64_t wait_ms;
+    };
+
+    int file_descriptor;
+    bool prompts;
+    bool at_end;
+    std::string partial; // Unterminated tail of the input read so far
+    std::deque<Queued> commands;
+    Entry entry;
+    ushort entry_port;
+    uint64_t rate;
+    double tokens;
+    uint64_t refilled_ms;
+    uint64_t resume_ms; // Set by a wait line
+
+    void parse_line(std::string line);
+
+    void push(CommandKind kind, ushort port, int location, const std::string &text);
+
+    void invalid(const std::string &text) { push(CommandKind::Invalid, 0, 0, text); }
+
+    CommandChannel(const CommandChannel &) = delete;
+
+    CommandChannel &operator=(const CommandChannel &) = delete;
+};
+
+#endif // COMMAND_CHANNEL_H
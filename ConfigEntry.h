@@ -7,6 +7,7 @@
 
 #include <string>
 #include <utility>
+#include <netinet/in.h>
 
 struct ConfigEntry {
     std::string ip;
@@ -14,11 +15,11 @@ struct ConfigEntry {
     int location;
     mutable int send_sequence;
     mutable int receive_sequence;
-
+    sockaddr_in address; // Resolved once by read_config so sends skip inet_pton
 
     ConfigEntry(std::string ip, ushort port, int location, int send_seq = 0, int receive_seq = 0)
             : ip(std::move(ip)), port(port), location(location), send_sequence(send_seq),
-              receive_sequence(receive_seq) {
+              receive_sequence(receive_seq), address() {
     }
 };
 
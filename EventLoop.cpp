@@ -0,0 +1,93 @@
+#include "EventLoop.h"
+#include "Log.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+uint64_t EventLoop::now_ms() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000;
+}
+
+EventLoop::EventLoop(uint64_t tick_ms)
+        : epoll_file_descriptor(epoll_create1(EPOLL_CLOEXEC)),
+          timer_file_descriptor(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+          running(false), wheel(tick_ms, now_ms()) {
+    if (epoll_file_descriptor < 0 || timer_file_descriptor < 0) {
+        std::cerr << "Error creating event loop: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // The timerfd ticks at the wheel resolution; each expiry advances the wheel to the current time
+    itimerspec spec{};
+    spec.it_interval.tv_sec = static_cast<time_t>(tick_ms / 1000);
+    spec.it_interval.tv_nsec = static_cast<long>((tick_ms % 1000) * 1000000);
+    spec.it_value = spec.it_interval;
+    timerfd_settime(timer_file_descriptor, 0, &spec, nullptr);
+
+    watch(timer_file_descriptor, [this]() {
+        uint64_t expirations;
+        while (read(timer_file_descriptor, &expirations, sizeof(expirations)) > 0) {}
+        wheel.advance(now_ms());
+    });
+}
+
+EventLoop::~EventLoop() {
+    close(timer_file_descriptor);
+    close(epoll_file_descriptor);
+}
+
+bool EventLoop::watch(int file_descriptor, const std::function<void()> &on_readable) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = file_descriptor;
+    if (epoll_ctl(epoll_file_descriptor, EPOLL_CTL_ADD, file_descriptor, &event) < 0) {
+        LOG_ERROR("epoll_ctl failed: " << strerror(errno));
+        return false;
+    }
+    handlers[file_descriptor] = std::make_shared<std::function<void()>>(on_readable);
+    return true;
+}
+
+void EventLoop::unwatch(int file_descriptor) {
+    epoll_ctl(epoll_file_descriptor, EPOLL_CTL_DEL, file_descriptor, nullptr);
+    handlers.erase(file_descriptor);
+}
+
+TimerId EventLoop::schedule_after(uint64_t delay_ms, const std::function<void()> &callback) {
+    return wheel.schedule_after(now_ms(), delay_ms, callback);
+}
+
+TimerId EventLoop::schedule_every(uint64_t interval_ms, const std::function<void()> &callback) {
+    return wheel.schedule_after(now_ms(), interval_ms, callback, interval_ms);
+}
+
+bool EventLoop::cancel(TimerId id) {
+    return wheel.cancel(id);
+}
+
+int EventLoop::run() {
+    epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    running = true;
+    while (running) {
+        int count = epoll_wait(epoll_file_descriptor, events, EVENT_LOOP_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("epoll_wait failed: " << strerror(errno));
+            return -1;
+        }
+        for (int i = 0; i < count && running; ++i) {
+            auto it = handlers.find(events[i].data.fd);
+            if (it == handlers.end()) continue; // Unwatched by an earlier handler in this round
+            // Hold a reference: the handler may unwatch itself
+            std::shared_ptr<std::function<void()>> handler = it->second;
+            (*handler)();
+        }
+    }
+    return 0;
+}
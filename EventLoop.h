@@ -0,0 +1,51 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include "TimerWheel.h"
+
+#define EVENT_LOOP_TICK_MS 10
+#define EVENT_LOOP_MAX_EVENTS 16
+
+// epoll-driven loop with a timerfd feeding a TimerWheel, so timers fire on schedule no matter
+// how busy the watched descriptors are.
+class EventLoop {
+public:
+    explicit EventLoop(uint64_t tick_ms = EVENT_LOOP_TICK_MS);
+
+    ~EventLoop();
+
+    bool watch(int file_descriptor, const std::function<void()> &on_readable);
+
+    void unwatch(int file_descriptor);
+
+    TimerId schedule_after(uint64_t delay_ms, const std::function<void()> &callback);
+
+    TimerId schedule_every(uint64_t interval_ms, const std::function<void()> &callback);
+
+    bool cancel(TimerId id);
+
+    // Returns 0 after stop(), -1 if epoll fails
+    int run();
+
+    void stop() { running = false; }
+
+    static uint64_t now_ms();
+
+private:
+    int epoll_file_descriptor;
+    int timer_file_descriptor;
+    bool running;
+    TimerWheel wheel;
+    std::unordered_map<int, std::shared_ptr<std::function<void()>>> handlers;
+
+    EventLoop(const EventLoop &) = delete;
+
+    EventLoop &operator=(const EventLoop &) = delete;
+};
+
+#endif // EVENT_LOOP_H
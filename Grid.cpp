@@ -0,0 +1,57 @@
+#include "Grid.h"
+#include <cstdlib>
+
+Grid::Grid(int rows, int cols, int range)
+        : row_count(rows), col_count(cols), radio_range(range),
+          offset_in_range(static_cast<size_t>((range + 1) * (range + 1))) {
+    // floor(sqrt(dr^2 + dc^2)) <= range  <=>  dr^2 + dc^2 < (range + 1)^2
+    const int limit = (range + 1) * (range + 1);
+    for (int dr = 0; dr <= range; ++dr) {
+        for (int dc = 0; dc <= range; ++dc) {
+            offset_in_range[static_cast<size_t>(dr * (range + 1) + dc)] = dr * dr + dc * dc < limit;
+        }
+    }
+}
+
+bool Grid::in_range(int a, int b) const {
+    if (!contains(a) || !contains(b)) return false;
+    const int dr = std::abs((a - 1) / col_count - (b - 1) / col_count);
+    const int dc = std::abs((a - 1) % col_count - (b - 1) % col_count);
+    if (dr > radio_range || dc > radio_range) return false;
+    return offset_in_range[static_cast<size_t>(dr * (radio_range + 1) + dc)] != 0;
+}
+
+const std::vector<uint64_t> &Grid::neighbors(int location, const std::vector<int> &peer_locations) {
+    auto it = neighbor_sets.find(location);
+    if (it != neighbor_sets.end()) return it->second;
+
+    std::vector<uint64_t> &set = neighbor_sets[location];
+    set.assign((peer_locations.size() + 63) / 64, 0);
+    for (size_t peer = 0; peer < peer_locations.size(); ++peer) {
+        if (in_range(location, peer_locations[peer])) set[peer / 64] |= static_cast<uint64_t>(1) << (peer % 64);
+    }
+    return set;
+}
+
+void Grid::update_around(int location, int peer, int peer_location) {
+    if (!contains(location)) return;
+    // Only cells within range of the old or new position can change membership
+    const int row = (location - 1) / col_count, col = (location - 1) % col_count;
+    for (int r = row - radio_range; r <= row + radio_range; ++r) {
+        if (r < 0 || r >= row_count) continue;
+        for (int c = col - radio_range; c <= col + radio_range; ++c) {
+            if (c < 0 || c >= col_count) continue;
+            auto it = neighbor_sets.find(r * col_count + c + 1);
+            if (it == neighbor_sets.end()) continue;
+            uint64_t bit = static_cast<uint64_t>(1) << (peer % 64);
+            uint64_t &word = it->second[static_cast<size_t>(peer) / 64];
+            word = in_range(it->first, peer_location) ? (word | bit) : (word & ~bit);
+        }
+    }
+}
+
+void Grid::move_peer(int peer, int old_location, int new_location) {
+    if (neighbor_sets.empty() || old_location == new_location) return;
+    update_around(old_location, peer, new_location);
+    update_around(new_location, peer, new_location);
+}
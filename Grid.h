@@ -0,0 +1,45 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Row-major grid of cells numbered from 1. Two cells are in radio range when the floor of their
+// Euclidean distance is at most range (the rule the old find_distance() check used). The
+// distance rule is precomputed into an offset table, so a range check is one lookup.
+class Grid {
+public:
+    Grid(int rows, int cols, int range);
+
+    int rows() const { return row_count; }
+
+    int cols() const { return col_count; }
+
+    int range() const { return radio_range; }
+
+    bool contains(int location) const { return location >= 1 && location <= row_count * col_count; }
+
+    // Locations outside the grid are never in range of anything
+    bool in_range(int a, int b) const;
+
+    // Bitset (64 peers per word) of the peers within range of location. Built on first use from
+    // peer_locations and kept current by move_peer() afterwards.
+    const std::vector<uint64_t> &neighbors(int location, const std::vector<int> &peer_locations);
+
+    void move_peer(int peer, int old_location, int new_location);
+
+    static bool has_peer(const std::vector<uint64_t> &set, int peer) {
+        return (set[static_cast<size_t>(peer) / 64] >> (peer % 64)) & 1u;
+    }
+
+private:
+    int row_count, col_count, radio_range;
+    std::vector<uint8_t> offset_in_range; // Indexed by |dr| * (range + 1) + |dc|
+    std::unordered_map<int, std::vector<uint64_t>> neighbor_sets;
+
+    void update_around(int location, int peer, int peer_location);
+};
+
+#endif // GRID_H
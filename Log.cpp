@@ -0,0 +1,280 @@
+#include "Log.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define LOG_DRAIN_BATCH 256
+
+namespace {
+
+struct Record {
+    LogLevel level;
+    size_t length;
+    char text[LOG_RECORD_SIZE];
+};
+
+// Bounded multi-producer queue: every slot carries a sequence number that says whose turn it
+// is, so producers claim slots with one compare-and-swap and never wait on each other
+class RecordQueue {
+public:
+    RecordQueue() : slots(LOG_QUEUE_CAPACITY), enqueue_position(0), dequeue_position(0) {
+        for (size_t i = 0; i < slots.size(); ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(LogLevel level, const char *text, size_t length) {
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true) {
+            slot = &slots[position & (slots.size() - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence == position) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (sequence < position) {
+                return false; // Full
+            } else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+        slot->record.level = level;
+        slot->record.length = length;
+        memcpy(slot->record.text, text, length);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Single consumer: the drain thread
+    const Record *front() {
+        Slot &slot = slots[dequeue_position & (slots.size() - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_position + 1) return nullptr;
+        return &slot.record;
+    }
+
+    void pop() {
+        Slot &slot = slots[dequeue_position & (slots.size() - 1)];
+        slot.sequence.store(dequeue_position + slots.size(), std::memory_order_release);
+        ++dequeue_position;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    std::vector<Slot> slots;
+    char padding_before[64];
+    std::atomic<size_t> enqueue_position;
+    char padding_between[64];
+    size_t dequeue_position;
+};
+
+std::atomic<int> current_level(LOG_LEVEL_INFO);
+std::atomic<bool> running(false);
+std::atomic<size_t> dropped(0);
+RecordQueue *queue = nullptr;
+std::thread drain_thread;
+
+// The drain thread blocks on wake_file_descriptor while the queue is empty. It sets idle first,
+// and only a producer that finds idle set writes to the eventfd, so a busy log costs no syscall
+// per record. writers counts LogLines between checking running and finishing their push, which
+// log_stop() waits out before it sets stop_requested.
+int wake_file_descriptor = -1;
+std::atomic<bool> idle(false);
+std::atomic<int> writers(0);
+std::atomic<bool> stop_requested(false);
+
+void wake_drain_thread() {
+    uint64_t one = 1;
+    while (write(wake_file_descriptor, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+void wait_for_wake() {
+    uint64_t count;
+    while (read(wake_file_descriptor, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
+
+void write_all(int file_descriptor, const std::string &buffer) {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t rc = write(file_descriptor, buffer.data() + written, buffer.size() - written);
+        if (rc <= 0) return;
+        written += static_cast<size_t>(rc);
+    }
+}
+
+void write_record(LogLevel level, const char *text, size_t length) {
+    std::string line(text, length);
+    line.push_back('\n');
+    write_all(level >= LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO, line);
+}
+
+// Moves up to one batch of records into the output buffers; returns how many it took
+size_t drain_batch(std::string &out, std::string &err) {
+    size_t count = 0;
+    const Record *record;
+    while (count < LOG_DRAIN_BATCH && (record = queue->front()) != nullptr) {
+        std::string &buffer = record->level >= LOG_LEVEL_WARN ? err : out;
+        buffer.append(record->text, record->length);
+        buffer.push_back('\n');
+        queue->pop();
+        ++count;
+    }
+    size_t lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost > 0) err += "Log queue full, " + std::to_string(lost) + " record(s) dropped\n";
+    return count;
+}
+
+void drain_loop() {
+    std::string out, err;
+    while (true) {
+        // Read before draining: once set, every record has been published, so the drain that
+        // follows is the final one
+        bool stopping = stop_requested.load(std::memory_order_acquire);
+        size_t count = drain_batch(out, err);
+        // One write per stream per batch instead of a flush per line
+        write_all(STDOUT_FILENO, out);
+        write_all(STDERR_FILENO, err);
+        out.clear();
+        err.clear();
+        if (count > 0) continue;
+        if (stopping) return;
+        idle.store(true, std::memory_order_relaxed);
+        // Pairs with the fence in ~LogLine: either its producer sees idle and wakes this thread,
+        // or the record it published is visible here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (queue->front() != nullptr || stop_requested.load(std::memory_order_acquire)) {
+            idle.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        wait_for_wake();
+        idle.store(false, std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+bool parse_log_level(const char *name, LogLevel &level) {
+    static const char *const names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_OFF; ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void set_log_level(LogLevel level) {
+    current_level.store(level, std::memory_order_relaxed);
+}
+
+bool log_enabled(LogLevel level) {
+    return level != LOG_LEVEL_OFF && level >= current_level.load(std::memory_order_relaxed);
+}
+
+void log_start() {
+    if (running) return;
+    if (queue == nullptr) queue = new RecordQueue();
+    wake_file_descriptor = eventfd(0, EFD_CLOEXEC);
+    if (wake_file_descriptor < 0) {
+        LOG_ERROR("Error creating eventfd, logging synchronously: " << strerror(errno));
+        return;
+    }
+    stop_requested = false;
+    running = true;
+    drain_thread = std::thread(drain_loop);
+}
+
+void log_stop() {
+    if (!running) return;
+    running = false;
+    // LogLines that saw running still set are finishing their push; later ones write directly
+    while (writers.load() > 0) std::this_thread::yield();
+    stop_requested.store(true, std::memory_order_release);
+    wake_drain_thread();
+    drain_thread.join();
+    close(wake_file_descriptor);
+    wake_file_descriptor = -1;
+}
+
+LogLine::~LogLine() {
+    if (truncated) {
+        length = LOG_RECORD_SIZE - 3;
+        memcpy(text + length, "...", 3);
+        length += 3;
+    }
+    writers.fetch_add(1);
+    if (!running.load()) {
+        writers.fetch_sub(1);
+        write_record(level, text, length);
+        return;
+    }
+    if (queue->try_push(level, text, length)) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle.load(std::memory_order_relaxed) && idle.exchange(false)) wake_drain_thread();
+    } else {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    writers.fetch_sub(1);
+}
+
+void LogLine::append(const char *data, size_t count) {
+    size_t room = LOG_RECORD_SIZE - length;
+    if (count > room) {
+        count = room;
+        truncated = true;
+    }
+    memcpy(text + length, data, count);
+    length += count;
+}
+
+LogLine &LogLine::operator<<(const char *value) {
+    append(value, strlen(value));
+    return *this;
+}
+
+LogLine &LogLine::operator<<(const std::string &value) {
+    append(value.data(), value.length());
+    return *this;
+}
+
+LogLine &LogLine::operator<<(const LogBytes &bytes) {
+    append(bytes.data, bytes.length);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(char c) {
+    append(&c, 1);
+    return *this;
+}
+
+LogLine &LogLine::operator<<(double value) {
+    char digits[32];
+    int count = snprintf(digits, sizeof(digits), "%g", value);
+    if (count > 0) append(digits, static_cast<size_t>(count));
+    return *this;
+}
+
+LogLine &LogLine::number(long long value) {
+    if (value < 0) {
+        append("-", 1);
+        return unsigned_number(0ULL - static_cast<unsigned long long>(value));
+    }
+    return unsigned_number(static_cast<unsigned long long>(value));
+}
+
+LogLine &LogLine::unsigned_number(unsigned long long value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    append(digits + sizeof(digits) - count, count);
+    return *this;
+}
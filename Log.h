@@ -0,0 +1,111 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <cstddef>
+#include <string>
+
+// Build with -DLOG_COMPILE_DEBUG=0 to compile LOG_DEBUG statements out entirely
+#ifndef LOG_COMPILE_DEBUG
+#define LOG_COMPILE_DEBUG 1
+#endif
+
+#define LOG_RECORD_SIZE 512   // Longer records are cut short and end in "..."
+#define LOG_QUEUE_CAPACITY 4096
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+// Returns false if name is not one of debug, info, warn, error, off
+bool parse_log_level(const char *name, LogLevel &level);
+
+void set_log_level(LogLevel level);
+
+bool log_enabled(LogLevel level);
+
+// Starts the thread that drains records to stdout (debug, info) and stderr (warn, error).
+// Records logged before log_start() or after log_stop() are written synchronously.
+void log_start();
+
+// Waits for records being queued, writes out everything still queued and joins the drain thread
+void log_stop();
+
+// Raw bytes for LogLine, e.g. a view into a receive buffer
+struct LogBytes {
+    const char *data;
+    size_t length;
+};
+
+inline LogBytes log_bytes(const char *data, size_t length) {
+    LogBytes bytes = {data, length};
+    return bytes;
+}
+
+// One record, formatted on the caller's stack without allocating and queued on destruction.
+// If the queue is full the record is dropped and counted rather than blocking the caller.
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level(level), length(0), truncated(false) {}
+
+    ~LogLine();
+
+    LogLine &operator<<(const char *text);
+
+    LogLine &operator<<(const std::string &text);
+
+    LogLine &operator<<(const LogBytes &bytes);
+
+    LogLine &operator<<(char c);
+
+    LogLine &operator<<(int value) { return number(value); }
+
+    LogLine &operator<<(unsigned value) { return unsigned_number(value); }
+
+    LogLine &operator<<(short value) { return number(value); }
+
+    LogLine &operator<<(unsigned short value) { return unsigned_number(value); }
+
+    LogLine &operator<<(long value) { return number(value); }
+
+    LogLine &operator<<(unsigned long value) { return unsigned_number(value); }
+
+    LogLine &operator<<(long long value) { return number(value); }
+
+    LogLine &operator<<(unsigned long long value) { return unsigned_number(value); }
+
+    LogLine &operator<<(double value);
+
+private:
+    LogLevel level;
+    size_t length;
+    bool truncated;
+    char text[LOG_RECORD_SIZE];
+
+    void append(const char *data, size_t count);
+
+    LogLine &number(long long value);
+
+    LogLine &unsigned_number(unsigned long long value);
+
+    LogLine(const LogLine &) = delete;
+
+    LogLine &operator=(const LogLine &) = delete;
+};
+
+#define LOG_AT(level, expression) \
+    do { if (log_enabled(level)) { LogLine log_line(level); log_line << expression; } } while (0)
+
+#if LOG_COMPILE_DEBUG
+#define LOG_DEBUG(expression) LOG_AT(LOG_LEVEL_DEBUG, expression)
+#else
+#define LOG_DEBUG(expression) do {} while (0)
+#endif
+#define LOG_INFO(expression) LOG_AT(LOG_LEVEL_INFO, expression)
+#define LOG_WARN(expression) LOG_AT(LOG_LEVEL_WARN, expression)
+#define LOG_ERROR(expression) LOG_AT(LOG_LEVEL_ERROR, expression)
+
+#endif // LOG_H
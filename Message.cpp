@@ -3,6 +3,7 @@
 #include <sstream>
 #include <iostream>
 #include <utility>
+#include <stdexcept>
 
 
 std::string strip_quotes(const std::string &input) {
@@ -20,6 +21,48 @@ std::string strip_quotes(const std::string &input) {
     return input.substr(start, end - start + 1);
 }
 
+// Writes value in decimal without going through std::to_string; out needs room for 20 chars
+static size_t format_number(long long value, char *out) {
+    char digits[20];
+    size_t count = 0;
+    bool negative = value < 0;
+    unsigned long long magnitude = negative ? 0ULL - static_cast<unsigned long long>(value)
+                                            : static_cast<unsigned long long>(value);
+    do {
+        digits[count++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    size_t length = 0;
+    if (negative) out[length++] = '-';
+    while (count > 0) out[length++] = digits[--count];
+    return length;
+}
+
+static void append_number(std::string &out, long long value) {
+    char text[24];
+    out.append(text, format_number(value, text));
+}
+
+static void append_hex(std::string &out, uint64_t value) {
+    char digits[16];
+    size_t count = 0;
+    do {
+        digits[count++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+    while (count > 0) out.push_back(digits[--count]);
+}
+
+// The [start, end) range of text without its leading and trailing quotes, as strip_quotes()
+static void unquoted_range(const std::string &text, size_t &start, size_t &end) {
+    start = text.find_first_not_of('"');
+    if (start == std::string::npos) {
+        start = end = 0;
+        return;
+    }
+    end = text.find_last_not_of('"') + 1;
+}
+
 BasePacket::BasePacket(unsigned long time, ushort to_port, ushort from_port, short ttl, short version, short flags,
                        int location, int sequence_number) :
         time(time), version(version), flags(flags), to_port(to_port), from_port(from_port), ttl(ttl),
@@ -53,15 +96,46 @@ void BasePacket::from_map(const std::unordered_map<std::string, std::string> &pa
 }
 
 std::string BasePacket::serialize() const {
-    std::string serializedForm = "time:" + std::to_string(time) +
-                                 " to_port:" + std::to_string(to_port) +
-                                 " from_port:" + std::to_string(from_port) +
-                                 " ttl:" + std::to_string(ttl) +
-                                 " version:" + std::to_string(version) +
-                                 " flags:" + std::to_string(flags) +
-                                 " location:" + std::to_string(location) +
-                                 " sequence_number:" + std::to_string(sequence_number);
-    return serializedForm;
+    std::string out;
+    encode_text(out);
+    return out;
+}
+
+void BasePacket::encode_text(std::string &out) const {
+    out += "time:";
+    append_number(out, static_cast<long long>(time));
+    out += " to_port:";
+    append_number(out, to_port);
+    out += " from_port:";
+    append_number(out, from_port);
+    out += " ttl:";
+    append_number(out, ttl);
+    out += " version:";
+    append_number(out, version);
+    out += " flags:";
+    append_number(out, flags);
+    out += " location:";
+    append_number(out, location);
+    out += " sequence_number:";
+    append_number(out, sequence_number);
+}
+
+const std::string &BasePacket::encoded() const {
+    wire.clear();
+    if (binary()) encode_binary(wire);
+    else encode_text(wire);
+    return wire;
+}
+
+const std::string &BasePacket::printable() const {
+    if (!binary()) return encoded();
+    printable_text.clear();
+    encode_text(printable_text);
+    return printable_text;
+}
+
+void BasePacket::put_binary_header(std::string &out, BinaryKind kind, size_t path_count) const {
+    ::put_binary_header(out, kind, time, to_port, from_port, ttl, flags, location, sequence_number, path_count);
 }
 
 // Packet implementation
@@ -69,7 +143,7 @@ Packet::Packet(unsigned long time, ushort to_port, ushort from_port, short ttl,
                short version, short flags, int location,
                int seqNumber, std::vector<ushort> send_path)
         : BasePacket(time, to_port, from_port, ttl, version, flags, location, seqNumber),
-          send_path(std::move(send_path)) {
+          send_path(std::move(send_path)), layout() {
 }
 
 Packet::~Packet() = default;
@@ -82,6 +156,10 @@ void Packet::parse_send_path(const std::string &send_path_string, std::vector<us
     }
 }
 
+std::vector<ushort> Packet::send_path_from_fields(const WireFields &fields) {
+    return std::vector<ushort>(fields.send_path, fields.send_path + fields.send_path_length);
+}
+
 std::unordered_map<std::string, std::string> Packet::to_map() const {
     auto map = BasePacket::to_map();
     std::ostringstream send_path_stream;
@@ -102,16 +180,146 @@ void Packet::from_map(const std::unordered_map<std::string, std::string> &packet
     send_path = path;
 }
 
-std::string Packet::serialize() const {
-    std::string base_serialized = BasePacket::serialize();
-    std::ostringstream send_path_stream;
-    for (const auto &port: send_path) {
-        if (send_path_stream.tellp() > 0) {
-            send_path_stream << ",";
+void Packet::reset(unsigned long time, ushort to_port, ushort from_port, short ttl, short version, short flags,
+                   int location, int sequence_number) {
+    this->time = time;
+    this->to_port = to_port;
+    this->from_port = from_port;
+    this->ttl = ttl;
+    this->version = version;
+    this->flags = flags;
+    this->location = location;
+    this->sequence_number = sequence_number;
+    layout.valid = false;
+}
+
+void Packet::assign_header(const WireFields &fields) {
+    reset(fields.time, fields.to_port, fields.from_port, fields.ttl, fields.version, fields.flags, fields.location,
+          fields.sequence_number);
+    send_path.assign(fields.send_path, fields.send_path + fields.send_path_length);
+}
+
+void Packet::put_binary_path(std::string &out) const {
+    for (size_t i = 0; i < send_path.size(); ++i) put_path_hop(out, i == 0 ? from_port : send_path[i - 1], send_path[i]);
+}
+
+void Packet::encode_text(std::string &out) const {
+    BasePacket::encode_text(out);
+    out += " send-path:";
+    for (size_t i = 0; i < send_path.size(); ++i) {
+        if (i > 0) out.push_back(',');
+        append_number(out, send_path[i]);
+    }
+}
+
+void Packet::splice(size_t offset, size_t old_length, const char *text, size_t length) const {
+    wire.replace(offset, old_length, text, length);
+    size_t *positions[] = {&layout.ttl_offset, &layout.location_offset, &layout.path_end};
+    for (size_t *position: positions) {
+        if (*position > offset) *position = *position + length - old_length;
+    }
+}
+
+void Packet::patch_binary() const {
+    // ttl and location sit at fixed header offsets and the path is the tail of the datagram
+    for (size_t i = layout.path_length; i < send_path.size(); ++i) {
+        put_path_hop(wire, i == 0 ? from_port : send_path[i - 1], send_path[i]);
+    }
+    wire[WIRE_BINARY_PATH_COUNT_OFFSET] = static_cast<char>(send_path.size());
+    put_i16(&wire[WIRE_BINARY_TTL_OFFSET], ttl);
+    put_i32(&wire[WIRE_BINARY_LOCATION_OFFSET], location);
+    layout.path_length = send_path.size();
+    layout.ttl = ttl;
+    layout.location = location;
+}
+
+const std::string &Packet::encoded() const {
+    if (!layout.valid || send_path.size() < layout.path_length) {
+        if (binary()) {
+            wire.clear();
+            encode_binary(wire);
+            layout.binary = true;
+            layout.ttl = ttl;
+            layout.location = location;
+            layout.path_length = send_path.size();
+            layout.valid = true;
+            return wire;
         }
-        send_path_stream << port;
+        wire.clear();
+        encode_text(wire);
+        // BasePacket::encode_text writes ttl, location and send-path ahead of any payload, so the
+        // first match is always the field itself
+        layout.ttl_offset = wire.find(" ttl:") + 5;
+        layout.ttl_length = wire.find(' ', layout.ttl_offset) - layout.ttl_offset;
+        layout.location_offset = wire.find(" location:") + 10;
+        layout.location_length = wire.find(' ', layout.location_offset) - layout.location_offset;
+        layout.path_end = wire.find(' ', wire.find(" send-path:") + 11);
+        if (layout.path_end == std::string::npos) layout.path_end = wire.length();
+        layout.ttl = ttl;
+        layout.location = location;
+        layout.path_length = send_path.size();
+        layout.binary = false;
+        layout.valid = true;
+        return wire;
+    }
+
+    if (layout.binary) {
+        patch_binary();
+        return wire;
+    }
+    char text[24];
+    for (size_t i = layout.path_length; i < send_path.size(); ++i) {
+        size_t length = 0;
+        if (i > 0) text[length++] = ',';
+        length += format_number(send_path[i], text + length);
+        splice(layout.path_end, 0, text, length);
+        layout.path_end += length;
     }
-    return base_serialized + " send-path:" + send_path_stream.str();
+    layout.path_length = send_path.size();
+    if (location != layout.location) {
+        size_t length = format_number(location, text);
+        splice(layout.location_offset, layout.location_length, text, length);
+        layout.location_length = length;
+        layout.location = location;
+    }
+    if (ttl != layout.ttl) {
+        size_t length = format_number(ttl, text);
+        splice(layout.ttl_offset, layout.ttl_length, text, length);
+        layout.ttl_length = length;
+        layout.ttl = ttl;
+    }
+    return wire;
+}
+
+void Packet::adopt_encoding(const WireFields &fields) {
+    if (fields.binary) {
+        wire.assign(fields.source.data, fields.source.length);
+        layout.binary = true;
+        layout.ttl = ttl;
+        layout.location = location;
+        layout.path_length = send_path.size();
+        layout.valid = true;
+        return;
+    }
+    const FieldView &ttl_value = fields.raw[KEY_TTL];
+    const FieldView &location_value = fields.raw[KEY_LOCATION];
+    const FieldView &path_value = fields.raw[KEY_SEND_PATH];
+    if (ttl_value.data == nullptr || location_value.data == nullptr || path_value.data == nullptr) {
+        layout.valid = false;
+        return;
+    }
+    const char *start = fields.source.data;
+    wire.assign(start, fields.source.length);
+    layout.ttl_offset = static_cast<size_t>(ttl_value.data - start);
+    layout.ttl_length = ttl_value.length;
+    layout.location_offset = static_cast<size_t>(location_value.data - start);
+    layout.location_length = location_value.length;
+    layout.path_end = static_cast<size_t>(path_value.data - start) + path_value.length;
+    layout.ttl = ttl;
+    layout.location = location;
+    layout.path_length = send_path.size();
+    layout.binary = false;
+    layout.valid = true;
 }
 
 // Message implementation
@@ -132,96 +340,131 @@ void Message::from_map(const std::unordered_map<std::string, std::string> &packe
     msg = packet_map.at("msg");
 }
 
-std::string Message::serialize() const {
-    std::ostringstream oss;
-    oss << Packet::serialize() << " msg:\"" << strip_quotes(this->msg) << "\"";
-    return oss.str();
+void Message::encode_text(std::string &out) const {
+    Packet::encode_text(out);
+    size_t start, end;
+    unquoted_range(msg, start, end);
+    out += " msg:\"";
+    out.append(msg, start, end - start);
+    out.push_back('"');
+}
+
+void Message::encode_binary(std::string &out) const {
+    size_t start, end;
+    unquoted_range(msg, start, end);
+    put_binary_header(out, BINARY_KIND_MESSAGE, send_path.size());
+    put_varint(out, static_cast<uint32_t>(end - start));
+    out.append(msg, start, end - start);
+    put_binary_path(out);
 }
 
 Message Message::deserialize(const std::string &message_content) {
-    const auto map = parse_message(message_content);
-    std::vector<ushort> path = {};
-    parse_send_path(map.at("send-path"), path);
-    Message message(
-            std::stoul(map.at("time")),
-            map.at("msg"),
-            static_cast<ushort>(std::stoi(map.at("to_port"))),
-            static_cast<ushort>(std::stoi(map.at("from_port"))),
-            static_cast<short>(std::stoi(map.at("ttl"))),
-            static_cast<short>(std::stoi(map.at("version"))),
-            static_cast<short>(std::stoi(map.at("flags"))),
-            std::stoi(map.at("location")),
-            (std::stoi(map.at("sequence_number"))),
-            path
-    );
-    return message;
+    WireFields fields;
+    if (!parse_wire(message_content, fields)) throw std::invalid_argument("malformed message");
+    if (classify_packet(fields) != PacketKind::Message || !fields.has(KEY_SEND_PATH)) {
+        throw std::out_of_range("not a message");
+    }
+    return deserialize(fields);
 }
 
-Message Message::deserialize(std::unordered_map<std::basic_string<char>, std::basic_string<char>> &map) {
-    std::vector<ushort> path = {};
-    parse_send_path(map.at("send-path"), path);
+Message Message::deserialize(const WireFields &fields) {
     Message message(
-            std::stoul(map.at("time")),
-            map.at("msg"),
-            static_cast<ushort>(std::stoi(map.at("to_port"))),
-            static_cast<ushort>(std::stoi(map.at("from_port"))),
-            static_cast<short>(std::stoi(map.at("ttl"))),
-            static_cast<short>(std::stoi(map.at("version"))),
-            static_cast<short>(std::stoi(map.at("flags"))),
-            std::stoi(map.at("location")),
-            (std::stoi(map.at("sequence_number"))),
-            path
+            fields.time,
+            fields.msg.str(),
+            fields.to_port,
+            fields.from_port,
+            fields.ttl,
+            fields.version,
+            fields.flags,
+            fields.location,
+            fields.sequence_number,
+            send_path_from_fields(fields)
     );
     return message;
 }
 
+void Message::assign(const WireFields &fields) {
+    assign_header(fields);
+    msg.assign(fields.msg.data, fields.msg.length);
+}
+
 // Acknowledgement implementation
 Acknowledgement::Acknowledgement(unsigned long time, std::string type, ushort to_port, ushort from_port,
                                  short ttl, short version, short flags, int location, int sequence_number,
                                  std::vector<ushort> send_path)
         : Packet(time, to_port, from_port, ttl, version, flags, location, sequence_number, std::move(send_path)),
-          type(std::move(type)) {
+          type(std::move(type)), cumulative_ack(NO_CUMULATIVE_ACK), sack(0) {
 }
 
 std::unordered_map<std::string, std::string> Acknowledgement::to_map() const {
     auto packet_map = Packet::to_map();
     packet_map["type"] = type;
+    if (cumulative_ack != NO_CUMULATIVE_ACK) {
+        packet_map["cum_ack"] = std::to_string(cumulative_ack);
+        std::string bitmap;
+        append_hex(bitmap, sack); // Hex, as on the text wire
+        packet_map["sack"] = bitmap;
+    }
     return packet_map;
 }
 
 void Acknowledgement::from_map(const std::unordered_map<std::string, std::string> &packet_map) {
     Packet::from_map(packet_map);
     type = packet_map.at("type");
+    auto cumulative = packet_map.find("cum_ack");
+    cumulative_ack = cumulative == packet_map.end() ? NO_CUMULATIVE_ACK : std::stoi(cumulative->second);
+    auto bitmap = packet_map.find("sack");
+    sack = bitmap == packet_map.end() ? 0 : std::stoull(bitmap->second, nullptr, 16);
+}
+
+void Acknowledgement::encode_text(std::string &out) const {
+    Packet::encode_text(out);
+    out += " type:";
+    out += type;
+    if (cumulative_ack != NO_CUMULATIVE_ACK) {
+        out += " cum_ack:";
+        append_number(out, cumulative_ack);
+        out += " sack:";
+        append_hex(out, sack);
+    }
 }
 
-std::string Acknowledgement::serialize() const {
-    std::ostringstream oss;
-    // Serialize common fields
-    oss << Packet::serialize();
-    // Add acknowledgement-specific part
-    oss << " type:" << this->type;
-    return oss.str();
+void Acknowledgement::encode_binary(std::string &out) const {
+    // The type is implied by the kind byte
+    put_binary_header(out, BINARY_KIND_ACKNOWLEDGEMENT, send_path.size());
+    put_varint(out, static_cast<uint64_t>(static_cast<long long>(cumulative_ack) + 1));
+    if (cumulative_ack != NO_CUMULATIVE_ACK) put_varint(out, sack);
+    put_binary_path(out);
 }
 
-Acknowledgement Acknowledgement::deserialize(std::unordered_map<std::basic_string<char>, std::basic_string<char>> &map) {
-    std::vector<ushort> path = {};
-    parse_send_path(map.at("send-path"), path);
+Acknowledgement Acknowledgement::deserialize(const WireFields &fields) {
     // Create and return an Acknowledgement object initialized with the extracted values
     Acknowledgement acknowledgement(
-            std::stoul(map.at("time")),
+            fields.time,
             "ACK",
-            static_cast<ushort>(std::stoi(map.at("to_port"))),
-            static_cast<ushort>(std::stoi(map.at("from_port"))),
-            static_cast<short>(std::stoi(map.at("ttl"))),
-            static_cast<short>(std::stoi(map.at("version"))),
-            static_cast<short>(std::stoi(map.at("flags"))),
-            std::stoi(map.at("location")),
-            (std::stoi(map.at("sequence_number"))),
-            path
+            fields.to_port,
+            fields.from_port,
+            fields.ttl,
+            fields.version,
+            fields.flags,
+            fields.location,
+            fields.sequence_number,
+            send_path_from_fields(fields)
     );
+    if (fields.has(KEY_CUMULATIVE_ACK)) {
+        acknowledgement.cumulative_ack = fields.cumulative_ack;
+        acknowledgement.sack = fields.sack;
+    }
     return acknowledgement;
 }
 
+void Acknowledgement::assign(const WireFields &fields) {
+    assign_header(fields);
+    type = "ACK";
+    cumulative_ack = fields.has(KEY_CUMULATIVE_ACK) ? fields.cumulative_ack : NO_CUMULATIVE_ACK;
+    sack = fields.has(KEY_CUMULATIVE_ACK) ? fields.sack : 0;
+}
+
 
 MoveCommand::MoveCommand(unsigned long time, ushort to_port, ushort from_port, short ttl,
                          short version, short flags, int location,
@@ -241,12 +484,18 @@ void MoveCommand::from_map(const std::unordered_map<std::string, std::string> &p
     move = std::stoi(packet_map.at("move"));
 }
 
-std::string MoveCommand::serialize() const {
-    std::ostringstream oss;
-    oss << BasePacket::serialize() << " "
-        << "move:" << move;
-    return oss.str();
+void MoveCommand::encode_text(std::string &out) const {
+    BasePacket::encode_text(out);
+    out += " move:";
+    append_number(out, move);
 }
 
+void MoveCommand::encode_binary(std::string &out) const {
+    put_binary_header(out, BINARY_KIND_MOVE, 0);
+    put_i32(out, move);
+}
 
-
+MoveCommand MoveCommand::deserialize(const WireFields &fields) {
+    return MoveCommand(fields.time, fields.to_port, fields.from_port, fields.ttl, fields.version, fields.flags,
+                       fields.location, fields.sequence_number, fields.move);
+}
@@ -7,9 +7,15 @@
 #include <bits/stl_vector.h>
 
 #include "ConfigEntry.h"
+#include "WireParser.h"
+#include "BinaryWire.h"
 
 typedef unsigned short ushort;
 
+// Flags field bits
+#define PACKET_FLAG_REROUTED 0x1 // Sent again after a move opened a new path to the destination
+#define PACKET_FLAG_RETRANSMITTED 0x2 // Resent by its origin after a timeout or a selective ACK gap
+
 class BasePacket {
 protected:
     unsigned long time;
@@ -31,7 +37,35 @@ public:
 
     virtual void from_map(const std::unordered_map<std::string, std::string> &packet_map);
 
-    virtual std::string serialize() const;
+    // Text form in a new string; encoded() reuses the packet's own buffer instead
+    std::string serialize() const;
+
+    // Wire form kept in a buffer owned by the packet; valid until the packet changes again.
+    // The version field picks the encoding: WIRE_BINARY_VERSION is binary, anything else text.
+    virtual const std::string &encoded() const;
+
+    bool binary() const { return version == WIRE_BINARY_VERSION; }
+
+    bool has_flag(short flag) const { return (flags & flag) != 0; }
+
+    // Text form for the console; the wire itself unless the packet is binary. Valid until the
+    // packet changes again.
+    const std::string &printable() const;
+
+    // Heap held by the cached wire and console forms, for callers that account for memory
+    size_t cached_capacity() const { return wire.capacity() + printable_text.capacity(); }
+
+protected:
+    mutable std::string wire;
+    mutable std::string printable_text; // Text form of a binary packet, kept to reuse its buffer
+
+    // Appends the text form, without allocating once out has the capacity
+    virtual void encode_text(std::string &out) const;
+
+    // Appends the binary form; see BinaryWire.h for the layout
+    virtual void encode_binary(std::string &out) const = 0;
+
+    void put_binary_header(std::string &out, BinaryKind kind, size_t path_count) const;
 
 };
 
@@ -47,11 +81,57 @@ public:
 
     static void parse_send_path(const std::string &send_path_string, std::vector<ushort> &path);
 
+    static std::vector<ushort> send_path_from_fields(const WireFields &fields);
+
     std::unordered_map<std::string, std::string> to_map() const override;
 
     void from_map(const std::unordered_map<std::string, std::string> &packet_map) override;
 
-    std::string serialize() const override;
+    // Refills every header field in place and drops the cached encoding, so one packet object
+    // can be sent again and again without reallocating its buffers; the caller sets send_path
+    void reset(unsigned long time, ushort to_port, ushort from_port, short ttl, short version, short flags,
+               int location, int sequence_number);
+
+    // Reuses the cached encoding when only ttl, location or appended send-path hops changed
+    // since it was built, patching just those values. Any other field edit after encoding must
+    // be followed by invalidate_encoding().
+    const std::string &encoded() const override;
+
+    // Takes the received datagram as the cached encoding, so a relay never re-formats it
+    void adopt_encoding(const WireFields &fields);
+
+    void invalidate_encoding() { layout.valid = false; }
+
+    void add_flag(short flag) {
+        flags = static_cast<short>(flags | flag);
+        layout.valid = false;
+    }
+
+private:
+    struct WireLayout {
+        bool valid;
+        bool binary; // Offsets below are only used by the text encoding
+        short ttl;
+        int location;
+        size_t path_length;
+        size_t ttl_offset, ttl_length;
+        size_t location_offset, location_length;
+        size_t path_end;
+    };
+
+    mutable WireLayout layout;
+
+    void splice(size_t offset, size_t old_length, const char *text, size_t length) const;
+
+    void patch_binary() const;
+
+protected:
+    void encode_text(std::string &out) const override;
+
+    void put_binary_path(std::string &out) const;
+
+    // Takes the header fields and send path from a parsed datagram, reusing this packet's buffers
+    void assign_header(const WireFields &fields);
 
 };
 
@@ -66,16 +146,29 @@ public:
 
     void from_map(const std::unordered_map<std::string, std::string> &packet_map) override;
 
-    std::string serialize() const override;
-
     static Message deserialize(const std::string &message_content);
 
-    static Message deserialize(std::unordered_map<std::basic_string<char>, std::basic_string<char>> &map);
+    // Expects the msg and send-path keys to be present; see classify_packet()
+    static Message deserialize(const WireFields &fields);
+
+    // deserialize() into this object, reusing its buffers
+    void assign(const WireFields &fields);
+
+protected:
+    void encode_text(std::string &out) const override;
+
+    void encode_binary(std::string &out) const override;
 };
 
+#define NO_CUMULATIVE_ACK (-1)
+
 class Acknowledgement : public Packet {
 public:
     std::string type;
+    // Receive window state of the acknowledging drone, or NO_CUMULATIVE_ACK for a plain ACK
+    // of sequence_number alone
+    int cumulative_ack;
+    uint64_t sack; // Bit i: cumulative_ack + 1 + i has arrived
 
     Acknowledgement(unsigned long time, std::string type, ushort to_port, ushort from_port, short ttl,
                     short version, short flags, int location, int sequence_number, std::vector<ushort> send_path);
@@ -84,9 +177,16 @@ public:
 
     void from_map(const std::unordered_map<std::string, std::string> &packet_map) override;
 
-    std::string serialize() const override;
+    // Expects the send-path key to be present; see classify_packet()
+    static Acknowledgement deserialize(const WireFields &fields);
 
-    static Acknowledgement deserialize(std::unordered_map<std::basic_string<char>, std::basic_string<char>> &map);
+    // deserialize() into this object, reusing its buffers
+    void assign(const WireFields &fields);
+
+protected:
+    void encode_text(std::string &out) const override;
+
+    void encode_binary(std::string &out) const override;
 
 };
 
@@ -105,7 +205,12 @@ public:
 
     void from_map(const std::unordered_map<std::string, std::string> &packet_map) override;
 
-    std::string serialize() const override;
+    static MoveCommand deserialize(const WireFields &fields);
+
+protected:
+    void encode_text(std::string &out) const override;
+
+    void encode_binary(std::string &out) const override;
 
 };
 
@@ -0,0 +1,124 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <sstream>
+
+PaddedCounter metric_counters[COUNTER_COUNT];
+
+Histogram metric_histograms[HISTOGRAM_COUNT];
+
+static const char *const counter_names[COUNTER_COUNT] = {
+        "received",
+        "oversized",
+        "parse_errors",
+        "out_of_range",
+        "ttl_expired",
+        "delivered",
+        "duplicate_messages",
+        "acks_received",
+        "duplicate_acks",
+        "acks_sent",
+        "forwarded",
+        "suppressed",
+        "routed",
+        "moves",
+        "originated",
+        "held",
+        "resent",
+        "rerouted",
+        "expired",
+        "envelopes",
+        "coalesced"
+};
+
+static const char *const histogram_names[HISTOGRAM_COUNT] = {
+        "decode_ns",
+        "apply_ns",
+        "ack_round_trip_us"
+};
+
+static const uint64_t started_ns = metrics_now_ns();
+
+Histogram::Histogram() : total(0), largest(0) {
+    for (auto &bucket: buckets) bucket.store(0, std::memory_order_relaxed);
+}
+
+size_t Histogram::bucket_of(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) return static_cast<size_t>(value);
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return static_cast<size_t>((shift + 1) * HISTOGRAM_SUB_BUCKETS) +
+           static_cast<size_t>((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+uint64_t Histogram::bucket_top(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+    size_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t lowest = static_cast<uint64_t>(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+    return lowest + ((static_cast<uint64_t>(1) << shift) - 1);
+}
+
+HistogramSummary Histogram::summarize() const {
+    // Buckets are read one at a time while other threads may still record, so the summary is
+    // approximate under load, which is all a capacity report needs
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        count += counts[i];
+    }
+    HistogramSummary summary = {count, 0, 0, 0, 0, 0, largest.load(std::memory_order_relaxed)};
+    if (count == 0) return summary;
+    summary.mean = total.load(std::memory_order_relaxed) / count;
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    uint64_t *targets[] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+    size_t next = 0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS && next < 4; ++i) {
+        seen += counts[i];
+        while (next < 4 && seen >= static_cast<uint64_t>(quantiles[next] * static_cast<double>(count) + 0.5)) {
+            *targets[next++] = std::min(bucket_top(i), summary.max);
+        }
+    }
+    return summary;
+}
+
+uint64_t metrics_counter(Counter counter) {
+    return metric_counters[counter].value.load(std::memory_order_relaxed);
+}
+
+uint64_t metrics_now_ns() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + static_cast<uint64_t>(now.tv_nsec);
+}
+
+std::string metrics_report() {
+    std::ostringstream report;
+    report << "uptime_s " << (metrics_now_ns() - started_ns) / 1000000000 << "\n";
+    for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+        report << counter_names[counter] << " " << metrics_counter(static_cast<Counter>(counter)) << "\n";
+    }
+    for (int histogram = 0; histogram < HISTOGRAM_COUNT; ++histogram) {
+        HistogramSummary summary = metric_histograms[histogram].summarize();
+        report << histogram_names[histogram] << " count=" << summary.count << " mean=" << summary.mean
+               << " p50=" << summary.p50 << " p90=" << summary.p90 << " p99=" << summary.p99
+               << " p999=" << summary.p999 << " max=" << summary.max << "\n";
+    }
+    return report.str();
+}
+
+bool metrics_write_snapshot(const std::string &path) {
+    std::string staging = path + ".tmp";
+    FILE *file = fopen(staging.c_str(), "w");
+    if (file == nullptr) return false;
+    std::string report = metrics_report();
+    bool written = fwrite(report.data(), 1, report.size(), file) == report.size();
+    if (fclose(file) != 0) written = false;
+    if (!written || rename(staging.c_str(), path.c_str()) != 0) {
+        remove(staging.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,122 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "RingQueue.h"
+
+// Event counters. Each one is a relaxed atomic on its own cache line, so any thread can bump
+// one for the price of an uncontended add.
+enum Counter {
+    COUNTER_RECEIVED,          // Datagrams taken off the socket
+    COUNTER_OVERSIZED,         // Datagrams dropped for not fitting the receive buffer
+    COUNTER_PARSE_ERRORS,      // Datagrams that did not parse or decode
+    COUNTER_OUT_OF_RANGE,      // Packets dropped because the sender was out of radio range
+    COUNTER_TTL_EXPIRED,       // Packets dropped with no TTL left
+    COUNTER_DELIVERED,         // Messages for this drone, first copy
+    COUNTER_DUPLICATE_MESSAGES,
+    COUNTER_ACKS_RECEIVED,     // ACKs that settled at least one message
+    COUNTER_DUPLICATE_ACKS,
+    COUNTER_ACKS_SENT,         // ACKs this drone originated, each covering one or more messages
+    COUNTER_FORWARDED,         // Packets relayed on behalf of other drones
+    COUNTER_SUPPRESSED,        // Copies not relayed because the seen cache already had them
+    COUNTER_ROUTED,            // Packets sent to one peer along a known route instead of flooded
+    COUNTER_MOVES,
+    COUNTER_ORIGINATED,        // Messages this drone sent for the first time
+    COUNTER_HELD,              // Messages queued behind a full send window
+    COUNTER_RESENT,
+    COUNTER_REROUTED,          // Stored messages sent again because a move made their destination reachable
+    COUNTER_EXPIRED,           // Messages that ran out of retries
+    COUNTER_ENVELOPES,         // Datagrams sent carrying more than one packet
+    COUNTER_COALESCED,         // Packets sent inside those envelopes
+    COUNTER_COUNT
+};
+
+enum HistogramId {
+    HISTOGRAM_DECODE_NS,          // Parsing and decoding one datagram
+    HISTOGRAM_APPLY_NS,           // Applying one decoded datagram to the drone state
+    HISTOGRAM_ACK_ROUND_TRIP_US,  // First send of a message to the ACK that settled it
+    HISTOGRAM_COUNT
+};
+
+// Bucket layout of a log-linear histogram: values below 2^HISTOGRAM_SUB_BITS get a bucket each,
+// every larger power of two is split into 2^HISTOGRAM_SUB_BITS equal buckets, so a bucket is at
+// most 1/16 of its value wide whatever the magnitude.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct HistogramSummary {
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+// HDR-style histogram over the whole uint64_t range in fixed memory. record() is a handful of
+// relaxed atomic adds, so it is safe and cheap from any thread; percentiles are read off the
+// buckets and reported as the top of the bucket they fall in.
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value) {
+        buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (value > seen && !largest.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    HistogramSummary summarize() const;
+
+    static size_t bucket_of(uint64_t value);
+
+    static uint64_t bucket_top(size_t bucket);
+
+private:
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> largest;
+
+    Histogram(const Histogram &) = delete;
+
+    Histogram &operator=(const Histogram &) = delete;
+};
+
+struct PaddedCounter {
+    std::atomic<uint64_t> value;
+    char padding[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+};
+
+extern PaddedCounter metric_counters[COUNTER_COUNT];
+
+extern Histogram metric_histograms[HISTOGRAM_COUNT];
+
+inline void metrics_add(Counter counter, uint64_t amount = 1) {
+    metric_counters[counter].value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+inline void metrics_record(HistogramId histogram, uint64_t value) {
+    metric_histograms[histogram].record(value);
+}
+
+uint64_t metrics_counter(Counter counter);
+
+// Monotonic clock for timing samples
+uint64_t metrics_now_ns();
+
+// Every counter as "name value" and every histogram as one line of percentiles, preceded by the
+// seconds since start, for the stats command and the snapshot file
+std::string metrics_report();
+
+// Replaces path with the current report through a rename, so readers never see half a file.
+// Returns false if it could not be written.
+bool metrics_write_snapshot(const std::string &path);
+
+#endif // METRICS_H
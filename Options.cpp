@@ -0,0 +1,158 @@
+#include "Options.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+void print_usage(const char *program) {
+    std::cerr << "Usage: " << program << " <Listen Port> [options]\n"
+              << "  --config <file>              peer list (default: Samiul Alam-config.file)\n"
+              << "  --rows <n>                   grid rows (default: 4)\n"
+              << "  --cols <n>                   grid columns (default: 4)\n"
+              << "  --range <n>                  radio range in cells (default: 2)\n"
+              << "  --wire <text|binary>         encoding for packets sent from here (default: text)\n"
+              << "  --workers <n>                decode threads behind a receive and a send thread;\n"
+              << "                               0 runs everything on one thread (default: 0)\n"
+              << "  --log-level <level>          debug, info, warn, error or off (default: info)\n"
+              << "  --seen-window-ms <ms>        relays drop packets they forwarded this recently;\n"
+              << "                               keep it below --rto-ms (default: half of --rto-ms)\n"
+              << "  --seen-capacity <n>          packets remembered per half window (default: 4096)\n"
+              << "  --stats-file <file>          rewrite runtime counters and latency percentiles here\n"
+              << "  --stats-interval-ms <ms>     how often the stats file is rewritten (default: 1000)\n"
+              << "  --route-ttl-ms <ms>          send along routes learned from send paths, each trusted this\n"
+              << "                               long, and flood only without one; 0 floods all (default: 0)\n"
+              << "  --ack-delay-ms <ms>          wait up to this long to cover several messages with one\n"
+              << "                               cumulative ACK; keep it well below --rto-ms (default: 0)\n"
+              << "  --ack-every <n>              with a delay, ACK at once after this many messages (default: 8)\n"
+              << "  --coalesce-ms <ms>           hold packets this long to pack several for one drone into\n"
+              << "                               a single datagram; 0 turns it off (default: 0)\n"
+              << "  --coalesce-bytes <n>         largest packed datagram, at most the receive buffer size\n"
+              << "                               (default and maximum: 1024)\n"
+              << "  --script <file>              run the commands in file (a fifo works too), alongside stdin\n"
+              << "  --command-rate <n>           most commands run per second from each source (default: no limit)\n"
+              << "  --rto-ms <ms>                first retransmission timeout (default: 1000)\n"
+              << "  --rto-max-ms <ms>            retransmission backoff cap (default: 20000)\n"
+              << "  --rto-jitter <fraction>      random spread applied to each timeout (default: 0.25)\n"
+              << "  --store-max-messages <n>     unacknowledged messages kept for resend (default: 4096)\n"
+              << "  --store-max-bytes <n>        memory cap for the resend store (default: 4194304)"
+              << std::endl;
+}
+
+static bool parse_unsigned(const char *text, uint64_t min, uint64_t max, uint64_t &out) {
+    if (*text == '\0' || *text == '-') return false;
+    char *end;
+    errno = 0;
+    unsigned long long value = std::strtoull(text, &end, 10);
+    if (errno != 0 || *end != '\0' || value < min || value > max) return false;
+    out = value;
+    return true;
+}
+
+static bool parse_fraction(const char *text, double &out) {
+    char *end;
+    errno = 0;
+    double value = std::strtod(text, &end);
+    if (errno != 0 || *end != '\0' || end == text || value < 0.0 || value >= 1.0) return false;
+    out = value;
+    return true;
+}
+
+int parse_options(int argc, char *argv[], DroneOptions &options) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    uint64_t number;
+    if (!parse_unsigned(argv[1], 1, 65535, number)) {
+        std::cerr << "Invalid listen port: " << argv[1] << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    options.listen_port = static_cast<ushort>(number);
+
+    for (int i = 2; i < argc; i += 2) {
+        const char *name = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << name << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[i + 1];
+        bool ok = true;
+        if (std::strcmp(name, "--config") == 0) {
+            options.config_file_path = value;
+        } else if (std::strcmp(name, "--rows") == 0) {
+            ok = parse_unsigned(value, 1, 65535, number);
+            options.rows = static_cast<int>(number);
+        } else if (std::strcmp(name, "--cols") == 0) {
+            ok = parse_unsigned(value, 1, 65535, number);
+            options.cols = static_cast<int>(number);
+        } else if (std::strcmp(name, "--range") == 0) {
+            ok = parse_unsigned(value, 0, 1024, number);
+            options.range = static_cast<int>(number);
+        } else if (std::strcmp(name, "--wire") == 0) {
+            ok = std::strcmp(value, "text") == 0 || std::strcmp(value, "binary") == 0;
+            options.binary_wire = std::strcmp(value, "binary") == 0;
+        } else if (std::strcmp(name, "--log-level") == 0) {
+            ok = parse_log_level(value, options.log_level);
+        } else if (std::strcmp(name, "--workers") == 0) {
+            ok = parse_unsigned(value, 0, 64, number);
+            options.workers = static_cast<size_t>(number);
+        } else if (std::strcmp(name, "--seen-window-ms") == 0) {
+            ok = parse_unsigned(value, 1, 3600000, options.seen_window_ms);
+        } else if (std::strcmp(name, "--seen-capacity") == 0) {
+            ok = parse_unsigned(value, 1, 1 << 24, number);
+            options.seen_capacity = static_cast<size_t>(number);
+        } else if (std::strcmp(name, "--stats-file") == 0) {
+            options.stats_file_path = value;
+        } else if (std::strcmp(name, "--stats-interval-ms") == 0) {
+            ok = parse_unsigned(value, 1, 3600000, options.stats_interval_ms);
+        } else if (std::strcmp(name, "--route-ttl-ms") == 0) {
+            ok = parse_unsigned(value, 0, 3600000, options.route_ttl_ms);
+        } else if (std::strcmp(name, "--ack-delay-ms") == 0) {
+            ok = parse_unsigned(value, 0, 1000, options.ack_delay_ms);
+        } else if (std::strcmp(name, "--ack-every") == 0) {
+            ok = parse_unsigned(value, 1, 64, number);
+            options.ack_every = static_cast<size_t>(number);
+        } else if (std::strcmp(name, "--coalesce-ms") == 0) {
+            ok = parse_unsigned(value, 0, 1000, options.coalesce_ms);
+        } else if (std::strcmp(name, "--coalesce-bytes") == 0) {
+            ok = parse_unsigned(value, 64, 1024, number);
+            options.coalesce_bytes = static_cast<size_t>(number);
+        } else if (std::strcmp(name, "--script") == 0) {
+            options.script_path = value;
+        } else if (std::strcmp(name, "--command-rate") == 0) {
+            ok = parse_unsigned(value, 0, 10000000, options.command_rate);
+        } else if (std::strcmp(name, "--rto-ms") == 0) {
+            ok = parse_unsigned(value, 1, 3600000, options.retransmit_timeout_ms);
+        } else if (std::strcmp(name, "--rto-max-ms") == 0) {
+            ok = parse_unsigned(value, 1, 3600000, options.retransmit_max_timeout_ms);
+        } else if (std::strcmp(name, "--rto-jitter") == 0) {
+            ok = parse_fraction(value, options.retransmit_jitter);
+        } else if (std::strcmp(name, "--store-max-messages") == 0) {
+            ok = parse_unsigned(value, 1, SIZE_MAX, number);
+            options.store_max_messages = static_cast<size_t>(number);
+        } else if (std::strcmp(name, "--store-max-bytes") == 0) {
+            ok = parse_unsigned(value, 1, SIZE_MAX, number);
+            options.store_max_bytes = static_cast<size_t>(number);
+        } else {
+            std::cerr << "Unknown option: " << name << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (!ok) {
+            std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (static_cast<long long>(options.rows) * options.cols > 0x7fffffff) {
+        std::cerr << "Grid of " << options.rows << " x " << options.cols << " is too large" << std::endl;
+        return 1;
+    }
+    if (options.seen_window_ms == 0) options.seen_window_ms = options.retransmit_timeout_ms / 2;
+    if (options.retransmit_max_timeout_ms < options.retransmit_timeout_ms) {
+        options.retransmit_max_timeout_ms = options.retransmit_timeout_ms;
+    }
+    return 0;
+}
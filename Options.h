@@ -0,0 +1,72 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Log.h"
+
+typedef unsigned short ushort;
+
+// Runtime settings for drone3. Everything except the listen port has a default, so
+// "drone3 <Listen Port>" keeps working.
+struct DroneOptions {
+    ushort listen_port = 0;
+    std::string config_file_path = "Samiul Alam-config.file";
+
+    // Grid geometry; locations are numbered 1..rows*cols in row-major order
+    int rows = 4;
+    int cols = 4;
+    int range = 2;
+
+    // Encoding of the packets this drone originates; received packets are read in either
+    bool binary_wire = false;
+
+    LogLevel log_level = LOG_LEVEL_INFO;
+
+    // Relays drop copies of a packet they passed on within this window; 0 means half the first
+    // retransmission timeout, so resends of a lost packet still get through
+    uint64_t seen_window_ms = 0;
+    size_t seen_capacity = 4096;
+
+    // Metrics snapshot rewritten every stats_interval_ms; empty disables it
+    std::string stats_file_path;
+    uint64_t stats_interval_ms = 1000;
+
+    // Packets go straight to their destination when it is in range, or to the next hop learned
+    // from earlier send paths, which is trusted for route_ttl_ms; 0 floods every packet
+    uint64_t route_ttl_ms = 0;
+
+    // Delivered messages are acknowledged once ack_every of them have arrived from a sender, or
+    // ack_delay_ms after the first, with one cumulative ACK; 0 acknowledges every message at once
+    uint64_t ack_delay_ms = 0;
+    size_t ack_every = 8;
+
+    // Outgoing packets wait up to coalesce_ms to share an envelope datagram of at most
+    // coalesce_bytes with others for the same drone; 0 sends every packet on its own
+    uint64_t coalesce_ms = 0;
+    size_t coalesce_bytes = 1024;
+
+    // Commands read from this file as well as stdin, and the most either source runs per second
+    // (0 for no limit)
+    std::string script_path;
+    uint64_t command_rate = 0;
+
+    // Decode worker threads; 0 keeps receive, decode and send on the main thread
+    size_t workers = 0;
+
+    // Retransmission store
+    uint64_t retransmit_timeout_ms = 1000;
+    uint64_t retransmit_max_timeout_ms = 20000;
+    double retransmit_jitter = 0.25;
+    size_t store_max_messages = 4096;
+    size_t store_max_bytes = 4 * 1024 * 1024;
+};
+
+void print_usage(const char *program);
+
+// Returns 0 on success; prints the problem and the usage text otherwise
+int parse_options(int argc, char *argv[], DroneOptions &options);
+
+#endif // OPTIONS_H
@@ -0,0 +1,31 @@
+#include "PeerTable.h"
+#include "Log.h"
+#include <algorithm>
+
+PeerTable::PeerTable() : index_by_port(UINT16_MAX + 1, UINT16_MAX) {}
+
+PeerTable::PeerTable(const std::vector<ConfigEntry> &entries) : PeerTable() {
+    for (const auto &entry: entries) {
+        if (index_by_port[entry.port] != UINT16_MAX) {
+            LOG_WARN("Port " << entry.port << " listed more than once in config, keeping the first");
+            continue;
+        }
+        index_by_port[entry.port] = static_cast<uint16_t>(ports.size());
+        ips.push_back(entry.ip);
+        ports.push_back(entry.port);
+        locations.push_back(entry.location);
+        send_windows.push_back(SendWindow(entry.send_sequence));
+        receive_windows.push_back(ReceiveWindow(entry.receive_sequence));
+        addresses.push_back(entry.address);
+    }
+    path_words.assign((ports.size() + 63) / 64, 0);
+}
+
+const std::vector<uint64_t> &PeerTable::path_set(const std::vector<ushort> &path) {
+    std::fill(path_words.begin(), path_words.end(), 0);
+    for (auto port: path) {
+        int peer = index_of(port);
+        if (peer != NO_PEER) path_words[static_cast<size_t>(peer) / 64] |= static_cast<uint64_t>(1) << (peer % 64);
+    }
+    return path_words;
+}
@@ -0,0 +1,43 @@
+#ifndef PEER_TABLE_H
+#define PEER_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+#include "ConfigEntry.h"
+#include "SlidingWindow.h"
+
+#define NO_PEER (-1)
+
+// The configured drones, addressed by a dense index. A direct port -> index array makes lookups
+// O(1), and per-peer state lives in parallel arrays so whole-swarm loops stay cache friendly.
+class PeerTable {
+public:
+    PeerTable();
+
+    explicit PeerTable(const std::vector<ConfigEntry> &entries);
+
+    // NO_PEER when the port is not in the config
+    int index_of(ushort port) const { return index_by_port[port] == UINT16_MAX ? NO_PEER : index_by_port[port]; }
+
+    int size() const { return static_cast<int>(ports.size()); }
+
+    // Bitset (64 peers per word, like Grid::neighbors) of the configured peers on a send path.
+    // The buffer is reused, so the set is only valid until the next call.
+    const std::vector<uint64_t> &path_set(const std::vector<ushort> &path);
+
+    std::vector<std::string> ips;
+    std::vector<ushort> ports;
+    std::vector<int> locations;
+    std::vector<SendWindow> send_windows;       // Messages this drone sent to the peer
+    std::vector<ReceiveWindow> receive_windows; // Messages the peer sent to this drone
+    std::vector<sockaddr_in> addresses;
+
+private:
+    std::vector<uint16_t> index_by_port;
+    std::vector<uint64_t> path_words;
+};
+
+#endif // PEER_TABLE_H
@@ -0,0 +1,204 @@
+#include "Pipeline.h"
+#include "BinaryWire.h"
+#include "Log.h"
+#include "Metrics.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Decoded datagrams a worker produces before it wakes the owning thread even though more input
+// is waiting, so a steady stream does not sit in the queue until the worker runs dry
+#define PIPELINE_WAKE_BATCH 64
+
+static int make_event(int flags) {
+    int file_descriptor = eventfd(0, EFD_CLOEXEC | flags);
+    if (file_descriptor < 0) {
+        std::cerr << "Error creating eventfd: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return file_descriptor;
+}
+
+static void signal_event(int file_descriptor) {
+    uint64_t one = 1;
+    while (write(file_descriptor, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+static void wait_event(int file_descriptor) {
+    uint64_t count;
+    while (read(file_descriptor, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
+
+Pipeline::Worker::Worker(size_t queue_capacity)
+        : wake_file_descriptor(make_event(0)), inbound(queue_capacity), decoded(queue_capacity) {}
+
+Pipeline::Worker::~Worker() {
+    close(wake_file_descriptor);
+}
+
+Pipeline::Pipeline(int listen_file_descriptor, int send_file_descriptor, size_t worker_count, size_t datagram_size,
+                   size_t queue_capacity)
+        : listen_file_descriptor(listen_file_descriptor), send_file_descriptor(send_file_descriptor),
+          datagram_size(datagram_size), wake_file_descriptor(make_event(EFD_NONBLOCK)),
+          stop_file_descriptor(make_event(0)), send_wake_file_descriptor(make_event(0)), stopping(false),
+          outbound(queue_capacity) {
+    for (size_t i = 0; i < worker_count; ++i) workers.emplace_back(new Worker(queue_capacity));
+    for (auto &worker: workers) threads.emplace_back(&Pipeline::worker_loop, this, std::ref(*worker));
+    threads.emplace_back(&Pipeline::send_loop, this);
+    threads.emplace_back(&Pipeline::receive_loop, this);
+}
+
+Pipeline::~Pipeline() {
+    stopping = true;
+    signal_event(stop_file_descriptor);
+    signal_event(send_wake_file_descriptor);
+    for (auto &worker: workers) signal_event(worker->wake_file_descriptor);
+    for (auto &thread: threads) thread.join();
+    close(wake_file_descriptor);
+    close(stop_file_descriptor);
+    close(send_wake_file_descriptor);
+}
+
+void Pipeline::receive_loop() {
+    ReceiveBatch batch(RECEIVE_BATCH_CAPACITY, datagram_size);
+    std::vector<bool> fed(workers.size());
+    pollfd descriptors[2] = {{listen_file_descriptor, POLLIN, 0},
+                             {stop_file_descriptor,   POLLIN, 0}};
+    // Copies one packet into the queue of the worker that takes source's datagrams; false if
+    // the pipeline stopped meanwhile
+    auto deal = [&](const sockaddr_in &source, const char *data, size_t length) {
+        size_t index = worker_for(source);
+        Worker &worker = *workers[index];
+        InboundDatagram *slot;
+        while ((slot = worker.inbound.producer_slot()) == nullptr) {
+            // The worker is behind; leave further datagrams in the kernel buffer meanwhile
+            signal_event(worker.wake_file_descriptor);
+            if (stopping) return false;
+            std::this_thread::yield();
+        }
+        slot->data.assign(data, data + length);
+        worker.inbound.publish();
+        fed[index] = true;
+        return true;
+    };
+    while (!stopping) {
+        if (poll(descriptors, 2, -1) < 0 && errno != EINTR) {
+            LOG_ERROR("poll failed: " << strerror(errno));
+            return;
+        }
+        if (descriptors[1].revents != 0) return;
+        int received;
+        do {
+            received = batch.receive(listen_file_descriptor);
+            if (received > 0) metrics_add(COUNTER_RECEIVED, static_cast<uint64_t>(received));
+            for (int i = 0; i < received; ++i) {
+                const ReceivedDatagram datagram = batch.datagram(static_cast<size_t>(i));
+                if (datagram.truncated) {
+                    metrics_add(COUNTER_OVERSIZED);
+                    LOG_WARN("Dropping oversized datagram (" << datagram.length << " bytes)");
+                    continue;
+                }
+                if (!is_envelope(datagram.data, datagram.length)) {
+                    if (!deal(datagram.source, datagram.data, datagram.length)) return;
+                    continue;
+                }
+                // Packets in an envelope all go to the same worker, in the order they were packed
+                EnvelopeReader reader(datagram.data, datagram.length);
+                const char *packet;
+                size_t length;
+                while (reader.next(packet, length)) {
+                    if (!deal(datagram.source, packet, length)) return;
+                }
+                if (reader.malformed()) {
+                    metrics_add(COUNTER_PARSE_ERRORS);
+                    LOG_WARN("Malformed envelope (" << datagram.length << " bytes)");
+                }
+            }
+            for (size_t index = 0; index < workers.size(); ++index) {
+                if (fed[index]) signal_event(workers[index]->wake_file_descriptor);
+                fed[index] = false;
+            }
+        } while (received == static_cast<int>(batch.capacity())); // More may be queued
+    }
+}
+
+size_t Pipeline::worker_for(const sockaddr_in &source) const {
+    // Fibonacci hashing spreads the consecutive ports drones usually run on across the workers
+    uint64_t key = (static_cast<uint64_t>(source.sin_addr.s_addr) << 16) | source.sin_port;
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) % workers.size();
+}
+
+void Pipeline::worker_loop(Worker &worker) {
+    size_t unannounced = 0;
+    while (true) {
+        InboundDatagram *input = worker.inbound.consumer_slot();
+        if (input == nullptr) {
+            if (unannounced > 0) signal_event(wake_file_descriptor);
+            unannounced = 0;
+            if (stopping) return;
+            wait_event(worker.wake_file_descriptor);
+            continue;
+        }
+        DecodedDatagram *output;
+        while ((output = worker.decoded.producer_slot()) == nullptr) {
+            signal_event(wake_file_descriptor);
+            if (stopping) return;
+            std::this_thread::yield();
+        }
+        uint64_t started = metrics_now_ns();
+        decode_datagram(input->data.data(), input->data.size(), *output);
+        metrics_record(HISTOGRAM_DECODE_NS, metrics_now_ns() - started);
+        worker.decoded.publish();
+        worker.inbound.release();
+        if (++unannounced == PIPELINE_WAKE_BATCH) {
+            signal_event(wake_file_descriptor);
+            unannounced = 0;
+        }
+    }
+}
+
+void Pipeline::send_loop() {
+    SendBatch batch(send_file_descriptor, SEND_BATCH_CAPACITY, true);
+    while (true) {
+        OutgoingDatagrams *datagrams = outbound.consumer_slot();
+        if (datagrams == nullptr) {
+            // Only stop once everything already queued is out
+            if (stopping) return;
+            wait_event(send_wake_file_descriptor);
+            continue;
+        }
+        for (const auto &destination: datagrams->destinations) {
+            batch.add(destination, datagrams->payload.data(), datagrams->payload.length());
+        }
+        batch.flush(); // The batch references the slot's payload, so it must go out before release
+        outbound.release();
+    }
+}
+
+size_t Pipeline::drain(const std::function<void(DecodedDatagram &)> &apply) {
+    uint64_t count;
+    while (read(wake_file_descriptor, &count, sizeof(count)) > 0) {}
+    size_t drained = 0;
+    for (auto &worker: workers) {
+        DecodedDatagram *decoded;
+        while ((decoded = worker->decoded.consumer_slot()) != nullptr) {
+            apply(*decoded);
+            worker->decoded.release();
+            ++drained;
+        }
+    }
+    return drained;
+}
+
+bool Pipeline::offload(OutgoingDatagrams &datagrams) {
+    OutgoingDatagrams *slot = outbound.producer_slot();
+    if (slot == nullptr) return false;
+    // Swap rather than move so the caller gets the slot's old buffers back to reuse
+    std::swap(*slot, datagrams);
+    outbound.publish();
+    signal_event(send_wake_file_descriptor);
+    return true;
+}
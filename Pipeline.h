@@ -0,0 +1,87 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "RingQueue.h"
+#include "Transport.h"
+#include "Utility.h"
+
+#define PIPELINE_QUEUE_CAPACITY 1024
+#define PIPELINE_MAX_WORKERS 64
+
+// A datagram copied out of the receive batch for a worker
+struct InboundDatagram {
+    std::vector<char> data;
+};
+
+// Staged receive path: a receive thread drains the socket with recvmmsg and deals datagrams to
+// the decode workers by source address; each worker parses and decodes into its own queue; the
+// thread that owns the drone state drains those queues (woken through wake_descriptor()) and
+// applies the results. Every datagram from one source goes through the same worker, so they are
+// applied in arrival order, which move commands (last writer wins) depend on; only datagrams
+// from different sources may be applied out of arrival order.
+//
+// Outgoing datagrams go the other way through offload() to a send thread. Every queue is
+// single-producer/single-consumer, so no stage takes a lock, and per-peer state is only ever
+// touched by the owning thread.
+class Pipeline {
+public:
+    Pipeline(int listen_file_descriptor, int send_file_descriptor, size_t workers, size_t datagram_size,
+             size_t queue_capacity = PIPELINE_QUEUE_CAPACITY);
+
+    // Stops every stage; datagrams already handed to offload() are still sent
+    ~Pipeline();
+
+    // Readable while decoded datagrams are waiting for drain()
+    int wake_descriptor() const { return wake_file_descriptor; }
+
+    // Calls apply for every decoded datagram that is ready; returns how many there were
+    size_t drain(const std::function<void(DecodedDatagram &)> &apply);
+
+    // Queues datagrams for the send thread; false when its queue is full. Only the owning
+    // thread may call it, which is what makes the send queue single-producer.
+    bool offload(OutgoingDatagrams &datagrams);
+
+private:
+    struct Worker {
+        explicit Worker(size_t queue_capacity);
+
+        ~Worker();
+
+        int wake_file_descriptor;
+        RingQueue<InboundDatagram> inbound;
+        RingQueue<DecodedDatagram> decoded;
+    };
+
+    int listen_file_descriptor;
+    int send_file_descriptor;
+    size_t datagram_size;
+    int wake_file_descriptor;
+    int stop_file_descriptor;
+    int send_wake_file_descriptor;
+    std::atomic<bool> stopping;
+    std::vector<std::unique_ptr<Worker>> workers;
+    RingQueue<OutgoingDatagrams> outbound;
+    std::vector<std::thread> threads;
+
+    void receive_loop();
+
+    // The worker that decodes every datagram from source
+    size_t worker_for(const sockaddr_in &source) const;
+
+    void worker_loop(Worker &worker);
+
+    void send_loop();
+
+    Pipeline(const Pipeline &) = delete;
+
+    Pipeline &operator=(const Pipeline &) = delete;
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,32 @@
+#include "Reachability.h"
+
+void Reachability::update(Grid &grid, const std::vector<int> &locations, int self) {
+    const int peers = static_cast<int>(locations.size());
+    first_hops.swap(previous_first_hops);
+    first_hops.assign(locations.size(), NO_PEER);
+    if (previous_first_hops.size() != locations.size()) previous_first_hops.assign(locations.size(), NO_PEER);
+
+    // Breadth first, so every peer keeps the first hop of a shortest path. self is marked
+    // visited with itself as first hop and reset at the end.
+    queue.clear();
+    queue.push_back(self);
+    first_hops[static_cast<size_t>(self)] = self;
+    for (size_t head = 0; head < queue.size(); ++head) {
+        int from = queue[head];
+        // The set is a reference into the grid's cache; adding other locations' sets does not
+        // invalidate it, and nothing moves while the search runs
+        const std::vector<uint64_t> &in_range = grid.neighbors(locations[static_cast<size_t>(from)], locations);
+        for (size_t word = 0; word < in_range.size(); ++word) {
+            for (uint64_t bits = in_range[word]; bits != 0; bits &= bits - 1) {
+                int peer = static_cast<int>(word * 64) + __builtin_ctzll(bits);
+                if (first_hops[static_cast<size_t>(peer)] != NO_PEER) continue;
+                first_hops[static_cast<size_t>(peer)] = from == self ? peer : first_hops[static_cast<size_t>(from)];
+                queue.push_back(peer);
+            }
+        }
+    }
+    first_hops[static_cast<size_t>(self)] = NO_PEER;
+
+    gained_count = 0;
+    for (int peer = 0; peer < peers; ++peer) gained_count += gained(peer);
+}
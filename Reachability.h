@@ -0,0 +1,36 @@
+#ifndef REACHABILITY_H
+#define REACHABILITY_H
+
+#include <cstddef>
+#include <vector>
+
+#include "Grid.h"
+#include "PeerTable.h"
+
+// The peers this drone can reach over any number of in-range hops, each with the neighbor that
+// starts a shortest path to it, found by breadth-first search over the grid. The previous
+// result is kept across update(), so a move can be judged by what it changed.
+class Reachability {
+public:
+    // Recomputes from the current locations; the old result becomes the previous one
+    void update(Grid &grid, const std::vector<int> &locations, int self);
+
+    // NO_PEER when peer cannot be reached (or is self)
+    int first_hop(int peer) const { return first_hops[static_cast<size_t>(peer)]; }
+
+    // Reachable now but not before the last update
+    bool gained(int peer) const {
+        return first_hops[static_cast<size_t>(peer)] != NO_PEER &&
+               previous_first_hops[static_cast<size_t>(peer)] == NO_PEER;
+    }
+
+    bool gained_any() const { return gained_count > 0; }
+
+private:
+    std::vector<int> first_hops;
+    std::vector<int> previous_first_hops;
+    std::vector<int> queue;
+    size_t gained_count = 0;
+};
+
+#endif // REACHABILITY_H
@@ -0,0 +1,104 @@
+#include "RetransmitStore.h"
+#include <algorithm>
+
+RetransmitStore::RetransmitStore(const RetransmitOptions &options, uint64_t seed)
+        : options(options), random(static_cast<std::minstd_rand::result_type>(seed | 1)), stored_bytes(0) {}
+
+uint64_t RetransmitStore::make_key(ushort from_port, ushort to_port, int sequence_number) {
+    return (static_cast<uint64_t>(from_port) << 48) | (static_cast<uint64_t>(to_port) << 32) |
+           static_cast<uint32_t>(sequence_number);
+}
+
+size_t RetransmitStore::footprint(const Message &message) {
+    return sizeof(Entry) + message.msg.capacity() + message.send_path.capacity() * sizeof(ushort) +
+           message.cached_capacity();
+}
+
+uint64_t RetransmitStore::jittered(uint64_t timeout_ms) {
+    if (options.jitter <= 0.0) return timeout_ms;
+    std::uniform_real_distribution<double> spread(1.0 - options.jitter, 1.0 + options.jitter);
+    uint64_t value = static_cast<uint64_t>(static_cast<double>(timeout_ms) * spread(random));
+    return value > 0 ? value : 1;
+}
+
+void RetransmitStore::schedule(uint64_t key, Entry &entry, uint64_t deadline_ms) {
+    entry.deadline_ms = deadline_ms;
+    ++entry.generation;
+    Deadline deadline = {deadline_ms, key, entry.generation};
+    deadlines.push(deadline);
+}
+
+bool RetransmitStore::insert(const Message &message, uint64_t now_ms) {
+    size_t bytes = footprint(message);
+    if (entries.size() >= options.max_messages || stored_bytes + bytes > options.max_bytes) return false;
+    uint64_t key = make_key(message.from_port, message.to_port, message.sequence_number);
+    auto inserted = entries.insert(std::make_pair(key, Entry{message, 0, options.initial_timeout_ms, 0, bytes, false}));
+    if (!inserted.second) return false;
+    stored_bytes += bytes;
+    Entry &entry = inserted.first->second;
+    schedule(key, entry, now_ms + jittered(entry.timeout_ms));
+    return true;
+}
+
+bool RetransmitStore::acknowledge(ushort from_port, ushort to_port, int sequence_number) {
+    auto it = entries.find(make_key(from_port, to_port, sequence_number));
+    if (it == entries.end()) return false;
+    // Its heap entry goes stale and is skipped (or compacted away) later
+    stored_bytes -= it->second.bytes;
+    entries.erase(it);
+    compact();
+    return true;
+}
+
+size_t RetransmitStore::collect_due(uint64_t now_ms, const std::function<void(const Message &)> &resend,
+                                    const std::function<void(const Message &)> &expire) {
+    size_t resent = 0;
+    while (!deadlines.empty() && deadlines.top().deadline_ms <= now_ms) {
+        Deadline due = deadlines.top();
+        deadlines.pop();
+        auto it = entries.find(due.key);
+        if (it == entries.end() || it->second.generation != due.generation) continue; // Stale
+        Entry &entry = it->second;
+        if (entry.message.ttl <= 0) {
+            expire(entry.message);
+            stored_bytes -= entry.bytes;
+            entries.erase(it);
+            continue;
+        }
+        --entry.message.ttl;
+        // Flagged so relays that passed on the first copy do not take this one for a flood copy
+        if (!entry.message.has_flag(PACKET_FLAG_RETRANSMITTED)) entry.message.add_flag(PACKET_FLAG_RETRANSMITTED);
+        resend(entry.message);
+        ++resent;
+        entry.timeout_ms = std::min(entry.timeout_ms * 2, options.max_timeout_ms);
+        schedule(due.key, entry, now_ms + jittered(entry.timeout_ms));
+    }
+    return resent;
+}
+
+void RetransmitStore::for_each(const std::function<void(const Message &)> &visit) const {
+    for (const auto &item: entries) visit(item.second.message);
+}
+
+bool RetransmitStore::expedite(ushort from_port, ushort to_port, int sequence_number, uint64_t now_ms) {
+    uint64_t key = make_key(from_port, to_port, sequence_number);
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.fast_retransmitted) return false;
+    it->second.fast_retransmitted = true;
+    if (it->second.deadline_ms > now_ms) schedule(key, it->second, now_ms);
+    compact();
+    return true;
+}
+
+void RetransmitStore::compact() {
+    // Rebuild the heap once stale deadlines dominate it, so it stays O(live messages)
+    if (deadlines.size() <= 2 * entries.size() + 64) return;
+    std::vector<Deadline> live;
+    live.reserve(entries.size());
+    for (const auto &item: entries) {
+        Deadline deadline = {item.second.deadline_ms, item.first, item.second.generation};
+        live.push_back(deadline);
+    }
+    deadlines = std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>>(
+            std::greater<Deadline>(), std::move(live));
+}
@@ -0,0 +1,89 @@
+#ifndef RETRANSMIT_STORE_H
+#define RETRANSMIT_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "Message.h"
+
+struct RetransmitOptions {
+    uint64_t initial_timeout_ms;
+    uint64_t max_timeout_ms;
+    double jitter; // Each timeout is scaled by a random factor in [1 - jitter, 1 + jitter]
+    size_t max_messages;
+    size_t max_bytes;
+};
+
+// Unacknowledged messages keyed by (from_port, to_port, sequence_number). Lookups and ACK
+// removal go through a hash index; a min-heap orders the per-message retry deadlines, and
+// every retry doubles that message's timeout (with jitter) so resends do not synchronize.
+class RetransmitStore {
+public:
+    RetransmitStore(const RetransmitOptions &options, uint64_t seed);
+
+    // Returns false when the message is already stored or the store is at its cap
+    bool insert(const Message &message, uint64_t now_ms);
+
+    // Returns true if a stored message was removed
+    bool acknowledge(ushort from_port, ushort to_port, int sequence_number);
+
+    // Hands every message whose deadline has passed to resend (after spending one TTL unit and
+    // flagging it PACKET_FLAG_RETRANSMITTED), or to expire once its TTL is used up. Returns the
+    // number of messages resent.
+    size_t collect_due(uint64_t now_ms, const std::function<void(const Message &)> &resend,
+                       const std::function<void(const Message &)> &expire);
+
+    // Calls visit for every stored message, leaving retry schedules and TTLs as they are
+    void for_each(const std::function<void(const Message &)> &visit) const;
+
+    // Makes one message due now, once: a selective ACK showed a gap where it should be. Returns
+    // false if the message is not stored or was already expedited this way.
+    bool expedite(ushort from_port, ushort to_port, int sequence_number, uint64_t now_ms);
+
+    bool empty() const { return entries.empty(); }
+
+    size_t size() const { return entries.size(); }
+
+    size_t bytes() const { return stored_bytes; }
+
+private:
+    struct Entry {
+        Message message;
+        uint64_t deadline_ms;
+        uint64_t timeout_ms;
+        uint32_t generation;
+        size_t bytes;
+        bool fast_retransmitted;
+    };
+
+    struct Deadline {
+        uint64_t deadline_ms;
+        uint64_t key;
+        uint32_t generation;
+
+        bool operator>(const Deadline &other) const { return deadline_ms > other.deadline_ms; }
+    };
+
+    RetransmitOptions options;
+    std::minstd_rand random;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+    size_t stored_bytes;
+
+    static uint64_t make_key(ushort from_port, ushort to_port, int sequence_number);
+
+    static size_t footprint(const Message &message);
+
+    uint64_t jittered(uint64_t timeout_ms);
+
+    void schedule(uint64_t key, Entry &entry, uint64_t deadline_ms);
+
+    void compact();
+};
+
+#endif // RETRANSMIT_STORE_H
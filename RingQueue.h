@@ -0,0 +1,90 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#define CACHE_LINE_SIZE 64
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. Slots are
+// constructed once and reused, so values that own buffers (strings, vectors) keep their
+// capacity from one trip to the next. The capacity is rounded up to a power of two.
+template<typename T>
+class RingQueue {
+public:
+    explicit RingQueue(size_t capacity)
+            : slots(round_up(capacity)), mask(slots.size() - 1), head(0), cached_tail(0), tail(0), cached_head(0) {}
+
+    size_t capacity() const { return slots.size(); }
+
+    // Producer: the slot to fill next, or nullptr when full. Nothing is visible to the consumer
+    // until publish().
+    T *producer_slot() {
+        size_t position = tail.load(std::memory_order_relaxed);
+        if (position - cached_head == slots.size()) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (position - cached_head == slots.size()) return nullptr;
+        }
+        return &slots[position & mask];
+    }
+
+    void publish() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Consumer: the oldest published slot, or nullptr when empty. The producer may not reuse
+    // it until release().
+    T *consumer_slot() {
+        size_t position = head.load(std::memory_order_relaxed);
+        if (position == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (position == cached_tail) return nullptr;
+        }
+        return &slots[position & mask];
+    }
+
+    void release() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    bool try_push(T &&value) {
+        T *slot = producer_slot();
+        if (slot == nullptr) return false;
+        *slot = std::move(value);
+        publish();
+        return true;
+    }
+
+    bool try_pop(T &value) {
+        T *slot = consumer_slot();
+        if (slot == nullptr) return false;
+        value = std::move(*slot);
+        release();
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // Each index sits next to the copy of the other index that its thread reads, a cache line
+    // away from the other side's, so producer and consumer do not false-share. Padding rather
+    // than alignas, since C++11 operator new does not honour over-alignment.
+    char padding_before[CACHE_LINE_SIZE];
+    std::atomic<size_t> head; // Written by the consumer
+    size_t cached_tail;       // Consumer's last view of tail
+    char padding_between[CACHE_LINE_SIZE];
+    std::atomic<size_t> tail; // Written by the producer
+    size_t cached_head;       // Producer's last view of head
+    char padding_after[CACHE_LINE_SIZE];
+
+    static size_t round_up(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    RingQueue(const RingQueue &) = delete;
+
+    RingQueue &operator=(const RingQueue &) = delete;
+};
+
+#endif // RING_QUEUE_H
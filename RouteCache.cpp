@@ -0,0 +1,38 @@
+#include "RouteCache.h"
+
+RouteCache::RouteCache(uint64_t ttl_ms) : ttl_ms(ttl_ms) {}
+
+void RouteCache::resize(size_t peers) {
+    routes.assign(peers, Route{NO_PEER, 0, 0});
+}
+
+void RouteCache::learn(const PeerTable &peers, int self, const std::vector<ushort> &path, uint64_t now_ms) {
+    if (!enabled() || path.empty()) return;
+    int neighbor = peers.index_of(path.back());
+    if (neighbor == NO_PEER || neighbor == self) return;
+    for (size_t i = 0; i < path.size(); ++i) {
+        int destination = peers.index_of(path[i]);
+        if (destination == NO_PEER || destination == self) continue;
+        size_t hops = path.size() - i;
+        Route &route = routes[static_cast<size_t>(destination)];
+        // Shorter or equal paths win; a longer one only replaces a route that has gone stale,
+        // and the current next hop refreshes its own route whatever the length
+        bool stale = route.next_hop == NO_PEER || now_ms - route.learned_ms >= ttl_ms;
+        if (stale || hops <= route.hops || route.next_hop == neighbor) {
+            route.next_hop = neighbor;
+            route.hops = hops;
+            route.learned_ms = now_ms;
+        }
+    }
+}
+
+int RouteCache::next_hop(int destination, uint64_t now_ms) const {
+    if (!enabled()) return NO_PEER;
+    const Route &route = routes[static_cast<size_t>(destination)];
+    if (route.next_hop == NO_PEER || now_ms - route.learned_ms >= ttl_ms) return NO_PEER;
+    return route.next_hop;
+}
+
+void RouteCache::forget(int destination) {
+    if (enabled()) routes[static_cast<size_t>(destination)].next_hop = NO_PEER;
+}
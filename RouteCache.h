@@ -0,0 +1,43 @@
+#ifndef ROUTE_CACHE_H
+#define ROUTE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PeerTable.h"
+
+// Next hops learned from the send paths of received packets: a packet that reached this drone
+// from neighbor N after visiting A, B, ... shows that A, B, ... can be reached back through N.
+// One route per destination, indexed like PeerTable. A route not confirmed by another packet
+// within the ttl is ignored, so one that went stale falls back to flooding.
+class RouteCache {
+public:
+    // A ttl of 0 disables the cache: nothing is learned and no route is ever known
+    explicit RouteCache(uint64_t ttl_ms);
+
+    void resize(size_t peers);
+
+    bool enabled() const { return ttl_ms > 0; }
+
+    // path is a received packet's send path; its last hop is the neighbor it came from
+    void learn(const PeerTable &peers, int self, const std::vector<ushort> &path, uint64_t now_ms);
+
+    // The peer to hand a packet for destination to, or NO_PEER when no fresh route is known
+    int next_hop(int destination, uint64_t now_ms) const;
+
+    // Drops the route to destination, e.g. when a packet sent along it went unacknowledged
+    void forget(int destination);
+
+private:
+    struct Route {
+        int next_hop;
+        size_t hops;
+        uint64_t learned_ms;
+    };
+
+    uint64_t ttl_ms;
+    std::vector<Route> routes;
+};
+
+#endif // ROUTE_CACHE_H
@@ -0,0 +1,63 @@
+#include "SeenCache.h"
+#include <algorithm>
+
+SeenCache::SeenCache(size_t capacity, uint64_t window_ms, uint64_t now_ms)
+        : current(0), capacity(std::max<size_t>(capacity, 1)), half_window_ms(std::max<uint64_t>(window_ms / 2, 1)),
+          rotated_at_ms(now_ms) {
+    // At most half full, so probe runs stay short
+    size_t size = 1;
+    while (size < this->capacity * 2) size <<= 1;
+    mask = size - 1;
+    for (auto &generation: generations) {
+        generation.slots.assign(size, 0);
+        generation.count = 0;
+    }
+}
+
+uint64_t SeenCache::make_key(bool acknowledgement, ushort from_port, ushort to_port, int sequence_number,
+                             bool rerouted, bool retransmitted) {
+    // Configured ports are never 0, so neither is the key
+    return (static_cast<uint64_t>(acknowledgement) << 63) | (static_cast<uint64_t>(from_port) << 47) |
+           (static_cast<uint64_t>(to_port) << 31) | (static_cast<uint64_t>(rerouted) << 30) |
+           (static_cast<uint64_t>(retransmitted) << 29) | (static_cast<uint64_t>(sequence_number) & 0x1fffffff);
+}
+
+size_t SeenCache::slot_of(uint64_t key) const {
+    // Fibonacci hashing spreads the structured keys over the whole table
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+bool SeenCache::contains(const Generation &generation, uint64_t key) const {
+    for (size_t slot = slot_of(key);; slot = (slot + 1) & mask) {
+        if (generation.slots[slot] == key) return true;
+        if (generation.slots[slot] == 0) return false;
+    }
+}
+
+void SeenCache::add(Generation &generation, uint64_t key) {
+    size_t slot = slot_of(key);
+    while (generation.slots[slot] != 0) slot = (slot + 1) & mask;
+    generation.slots[slot] = key;
+    ++generation.count;
+}
+
+void SeenCache::rotate(uint64_t now_ms) {
+    current ^= 1;
+    Generation &fresh = generations[current];
+    std::fill(fresh.slots.begin(), fresh.slots.end(), 0);
+    fresh.count = 0;
+    rotated_at_ms = now_ms;
+}
+
+bool SeenCache::insert(uint64_t key, uint64_t now_ms) {
+    if (now_ms - rotated_at_ms >= half_window_ms) {
+        // A whole window without a rotation leaves nothing in either generation worth keeping
+        if (now_ms - rotated_at_ms >= 2 * half_window_ms) rotate(now_ms);
+        rotate(now_ms);
+    }
+    if (contains(generations[current], key)) return false;
+    if (contains(generations[current ^ 1], key)) return false;
+    if (generations[current].count >= capacity) rotate(now_ms);
+    add(generations[current], key);
+    return true;
+}
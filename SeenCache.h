@@ -0,0 +1,53 @@
+#ifndef SEEN_CACHE_H
+#define SEEN_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef unsigned short ushort;
+
+// Packets a relay has already passed on, so copies arriving along other paths are not flooded
+// again. Keys live in two fixed open-addressing tables: new keys go into the current one and
+// every half window the older one is cleared and becomes current. A repeat within half a window
+// is always caught, none is after a full window, and memory never grows past the capacity.
+// Resent copies are flagged and keyed apart from the first (see make_key()), but the window
+// still has to stay shorter than the retransmission timeout, or a second resend of a lost
+// packet would be suppressed along with the flood copies of the first.
+class SeenCache {
+public:
+    // capacity is the number of keys a generation holds before it rotates early
+    SeenCache(size_t capacity, uint64_t window_ms, uint64_t now_ms);
+
+    // Records the key; returns false if it was already recorded within the window
+    bool insert(uint64_t key, uint64_t now_ms);
+
+    // Rerouted and retransmitted copies (see PACKET_FLAG_REROUTED, PACKET_FLAG_RETRANSMITTED)
+    // get keys of their own, so having relayed the first copy does not suppress them. Sequence
+    // numbers are taken modulo 2^29.
+    static uint64_t make_key(bool acknowledgement, ushort from_port, ushort to_port, int sequence_number,
+                             bool rerouted = false, bool retransmitted = false);
+
+private:
+    struct Generation {
+        std::vector<uint64_t> slots; // 0 marks an empty slot; keys are never 0 (see make_key)
+        size_t count;
+    };
+
+    Generation generations[2];
+    size_t current;
+    size_t capacity;
+    size_t mask;
+    uint64_t half_window_ms;
+    uint64_t rotated_at_ms;
+
+    size_t slot_of(uint64_t key) const;
+
+    bool contains(const Generation &generation, uint64_t key) const;
+
+    void add(Generation &generation, uint64_t key);
+
+    void rotate(uint64_t now_ms);
+};
+
+#endif // SEEN_CACHE_H
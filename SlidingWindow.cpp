@@ -0,0 +1,40 @@
+#include "SlidingWindow.h"
+
+bool ReceiveWindow::accept(int sequence_number) {
+    if (sequence_number <= cumulative) return false;
+    long long offset = static_cast<long long>(sequence_number) - cumulative - 1;
+    if (offset >= SLIDING_WINDOW_SIZE) {
+        long long shift = offset - SLIDING_WINDOW_SIZE + 1;
+        bitmap = shift >= SLIDING_WINDOW_SIZE ? 0 : bitmap >> shift;
+        cumulative = static_cast<int>(cumulative + shift);
+        offset = SLIDING_WINDOW_SIZE - 1;
+    }
+    uint64_t bit = static_cast<uint64_t>(1) << offset;
+    if (bitmap & bit) return false;
+    bitmap |= bit;
+    while (bitmap & 1) {
+        bitmap >>= 1;
+        ++cumulative;
+    }
+    return true;
+}
+
+int SendWindow::open() {
+    outstanding |= static_cast<uint64_t>(1) << (next - base);
+    return next++;
+}
+
+bool SendWindow::in_flight(int sequence_number) const {
+    if (sequence_number < base || sequence_number >= next) return false;
+    return (outstanding >> (sequence_number - base)) & 1;
+}
+
+bool SendWindow::resolve(int sequence_number) {
+    if (!in_flight(sequence_number)) return false;
+    outstanding &= ~(static_cast<uint64_t>(1) << (sequence_number - base));
+    while (base < next && (outstanding & 1) == 0) {
+        outstanding >>= 1;
+        ++base;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef SLIDING_WINDOW_H
+#define SLIDING_WINDOW_H
+
+#include <cstdint>
+
+// Width of both windows; it is also the number of bits in a selective ACK bitmap
+#define SLIDING_WINDOW_SIZE 64
+
+// Messages from one sender, numbered from 1. Everything up to cumulative has arrived; bit i of
+// bitmap means cumulative + 1 + i has arrived too, so out-of-order messages are kept instead
+// of being mistaken for duplicates.
+struct ReceiveWindow {
+    int cumulative;
+    uint64_t bitmap;
+
+    explicit ReceiveWindow(int cumulative = 0) : cumulative(cumulative), bitmap(0) {}
+
+    // Returns false for a duplicate. A sequence beyond the window slides it forward: the
+    // sender only goes that far once it has given up on the older messages.
+    bool accept(int sequence_number);
+};
+
+// Messages to one destination. Sequences base .. next - 1 are in flight and bit i of
+// outstanding is set while base + i still waits for its ACK (or for its retries to run out).
+struct SendWindow {
+    int base;
+    int next;
+    uint64_t outstanding;
+
+    explicit SendWindow(int last_sent = 0) : base(last_sent + 1), next(last_sent + 1), outstanding(0) {}
+
+    bool full() const { return next - base >= SLIDING_WINDOW_SIZE; }
+
+    // Reserves the next sequence number; only valid while !full()
+    int open();
+
+    // The message is acknowledged or abandoned; returns false if it was not in flight
+    bool resolve(int sequence_number);
+
+    bool in_flight(int sequence_number) const;
+};
+
+#endif // SLIDING_WINDOW_H
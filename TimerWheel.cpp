@@ -0,0 +1,103 @@
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel(uint64_t tick_ms, uint64_t now_ms)
+        : tick(tick_ms > 0 ? tick_ms : 1), current_tick(now_ms / (tick_ms > 0 ? tick_ms : 1)), next_id(1),
+          firing(0), firing_cancelled(false) {}
+
+TimerId TimerWheel::schedule_at(uint64_t deadline_ms, const std::function<void()> &callback, uint64_t interval_ms) {
+    TimerId id = next_id++;
+    Timer &timer = timers[id];
+    // Round up so a timer never fires before its deadline
+    timer.deadline_tick = (deadline_ms + tick - 1) / tick;
+    timer.interval_ticks = interval_ms > 0 ? (interval_ms + tick - 1) / tick : 0;
+    timer.callback = callback;
+    place(id, timer.deadline_tick);
+    return id;
+}
+
+TimerId TimerWheel::schedule_after(uint64_t now_ms, uint64_t delay_ms, const std::function<void()> &callback,
+                                   uint64_t interval_ms) {
+    return schedule_at(now_ms + delay_ms, callback, interval_ms);
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    if (id != 0 && id == firing) {
+        firing_cancelled = true;
+        return true;
+    }
+    // The slot keeps a stale id that is skipped when its slot comes up
+    return timers.erase(id) > 0;
+}
+
+void TimerWheel::place(TimerId id, uint64_t deadline_tick) {
+    if (deadline_tick <= current_tick) deadline_tick = current_tick + 1;
+    uint64_t delta = deadline_tick - current_tick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (static_cast<uint64_t>(1) << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    uint64_t max_delta = static_cast<uint64_t>(1) << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS);
+    if (delta >= max_delta) deadline_tick = current_tick + max_delta - 1; // Re-placed when it cascades
+    size_t slot = (deadline_tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    slots[level][slot].push_back(id);
+}
+
+void TimerWheel::cascade(int level) {
+    size_t slot = (current_tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    std::vector<TimerId> moving;
+    moving.swap(slots[level][slot]);
+    for (TimerId id: moving) {
+        auto it = timers.find(id);
+        if (it == timers.end()) continue;
+        if (it->second.deadline_tick <= current_tick) {
+            // Due on this very tick; level 0 for the current tick is processed right after cascading
+            slots[0][current_tick & (TIMER_WHEEL_SLOTS - 1)].push_back(id);
+        } else {
+            place(id, it->second.deadline_tick);
+        }
+    }
+}
+
+size_t TimerWheel::advance(uint64_t now_ms) {
+    uint64_t target_tick = now_ms / tick;
+    size_t fired = 0;
+    std::vector<TimerId> due;
+    while (current_tick < target_tick) {
+        ++current_tick;
+        // When a level wraps around, pull the next slot of the coarser level down
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+            uint64_t mask = (static_cast<uint64_t>(1) << (TIMER_WHEEL_SLOT_BITS * level)) - 1;
+            if ((current_tick & mask) != 0) break;
+            cascade(level);
+        }
+
+        due.clear();
+        due.swap(slots[0][current_tick & (TIMER_WHEEL_SLOTS - 1)]);
+        for (TimerId id: due) {
+            auto it = timers.find(id);
+            if (it == timers.end()) continue;
+            if (it->second.deadline_tick > current_tick) {
+                place(id, it->second.deadline_tick); // Clamped far-future timer, not due yet
+                continue;
+            }
+            ++fired;
+            if (it->second.interval_ticks == 0) {
+                std::function<void()> callback = std::move(it->second.callback);
+                timers.erase(it);
+                callback();
+                continue;
+            }
+            // Periodic timers run in place (map nodes survive rehashing); a cancel from inside the
+            // callback is deferred until it returns
+            it->second.deadline_tick = current_tick + it->second.interval_ticks;
+            place(id, it->second.deadline_tick);
+            firing = id;
+            firing_cancelled = false;
+            it->second.callback();
+            firing = 0;
+            if (firing_cancelled) timers.erase(id);
+        }
+    }
+    return fired;
+}
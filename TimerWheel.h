@@ -0,0 +1,60 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+typedef uint64_t TimerId;
+
+// Hierarchical timing wheel: four levels of 64 slots cover 64^4 ticks. A timer lives in the
+// coarsest level that still resolves its deadline and cascades down as time approaches it, so
+// scheduling, cancelling and expiring are all O(1) regardless of how many timers are pending.
+class TimerWheel {
+public:
+    TimerWheel(uint64_t tick_ms, uint64_t now_ms);
+
+    // interval_ms > 0 makes the timer periodic; it then keeps its id until cancelled
+    TimerId schedule_at(uint64_t deadline_ms, const std::function<void()> &callback, uint64_t interval_ms = 0);
+
+    TimerId schedule_after(uint64_t now_ms, uint64_t delay_ms, const std::function<void()> &callback,
+                           uint64_t interval_ms = 0);
+
+    bool cancel(TimerId id);
+
+    // Runs every timer whose deadline is at or before now_ms; returns how many fired
+    size_t advance(uint64_t now_ms);
+
+    bool empty() const { return timers.empty(); }
+
+    size_t size() const { return timers.size(); }
+
+    uint64_t tick_ms() const { return tick; }
+
+private:
+    struct Timer {
+        uint64_t deadline_tick;
+        uint64_t interval_ticks;
+        std::function<void()> callback;
+    };
+
+    uint64_t tick;
+    uint64_t current_tick;
+    TimerId next_id;
+    TimerId firing;
+    bool firing_cancelled;
+    std::unordered_map<TimerId, Timer> timers;
+    std::vector<TimerId> slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    void place(TimerId id, uint64_t deadline_tick);
+
+    void cascade(int level);
+};
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,129 @@
+#include "Transport.h"
+#include "Log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+static SendOffload send_offload;
+
+void set_send_offload(const SendOffload &offload) {
+    send_offload = offload;
+}
+
+SendBatch::SendBatch(int socket_file_descriptor, size_t capacity, bool direct)
+        : socket_file_descriptor(socket_file_descriptor), pending(0), direct(direct), headers(capacity),
+          vectors(capacity) {}
+
+SendBatch::~SendBatch() {
+    flush();
+}
+
+void SendBatch::add(const ConfigEntry &entry, const std::string &payload) {
+    add(entry.address, payload.data(), payload.length());
+}
+
+void SendBatch::add(const sockaddr_in &address, const char *data, size_t length) {
+    if (pending == headers.size()) flush();
+    iovec &vector = vectors[pending];
+    vector.iov_base = const_cast<char *>(data);
+    vector.iov_len = length;
+
+    msghdr &header = headers[pending].msg_hdr;
+    memset(&header, 0, sizeof(header));
+    header.msg_name = const_cast<sockaddr_in *>(&address);
+    header.msg_namelen = sizeof(address);
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    ++pending;
+}
+
+bool SendBatch::offload_pending() {
+    // The offload outlives this batch's payload references, so each distinct payload is copied
+    // once and shared by the run of addresses that follow it
+    size_t i = 0;
+    while (i < pending) {
+        OutgoingDatagrams &datagrams = staging;
+        datagrams.destinations.clear();
+        const iovec &vector = vectors[i];
+        datagrams.payload.assign(static_cast<const char *>(vector.iov_base), vector.iov_len);
+        for (; i < pending && vectors[i].iov_base == vector.iov_base && vectors[i].iov_len == vector.iov_len; ++i) {
+            datagrams.destinations.push_back(*static_cast<const sockaddr_in *>(headers[i].msg_hdr.msg_name));
+        }
+        if (!send_offload(datagrams)) {
+            // Send the rest here rather than dropping them
+            size_t first = i - datagrams.destinations.size();
+            if (first > 0) {
+                std::move(headers.begin() + static_cast<long>(first), headers.begin() + static_cast<long>(pending),
+                          headers.begin());
+                std::move(vectors.begin() + static_cast<long>(first), vectors.begin() + static_cast<long>(pending),
+                          vectors.begin());
+                pending -= first;
+                for (size_t j = 0; j < pending; ++j) headers[j].msg_hdr.msg_iov = &vectors[j];
+            }
+            return false;
+        }
+    }
+    pending = 0;
+    return true;
+}
+
+size_t SendBatch::flush() {
+    if (!direct && send_offload && pending > 0) {
+        size_t offered = pending;
+        if (offload_pending()) return offered;
+    }
+    size_t sent = 0, accepted = 0;
+    while (sent < pending) {
+        int rc = sendmmsg(socket_file_descriptor, &headers[sent], static_cast<unsigned int>(pending - sent), 0);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("sendmmsg failed: " << strerror(errno));
+            // Skip the datagram the kernel refused so one bad peer does not drop the whole batch
+            ++sent;
+            continue;
+        }
+        sent += static_cast<size_t>(rc);
+        accepted += static_cast<size_t>(rc);
+    }
+    pending = 0;
+    return accepted;
+}
+
+ReceiveBatch::ReceiveBatch(size_t capacity, size_t buffer_size)
+        : buffer_size(buffer_size), buffers(capacity * buffer_size), headers(capacity), vectors(capacity),
+          sources(capacity) {}
+
+int ReceiveBatch::receive(int socket_file_descriptor) {
+    for (size_t i = 0; i < headers.size(); ++i) {
+        vectors[i].iov_base = &buffers[i * buffer_size];
+        vectors[i].iov_len = buffer_size;
+
+        msghdr &header = headers[i].msg_hdr;
+        memset(&header, 0, sizeof(header));
+        header.msg_name = &sources[i];
+        header.msg_namelen = sizeof(sources[i]);
+        header.msg_iov = &vectors[i];
+        header.msg_iovlen = 1;
+        headers[i].msg_len = 0;
+    }
+    int rc;
+    do {
+        rc = recvmmsg(socket_file_descriptor, headers.data(), static_cast<unsigned int>(headers.size()),
+                      MSG_DONTWAIT | MSG_TRUNC, nullptr); // MSG_TRUNC reports the real size of oversized datagrams
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        LOG_ERROR("recvmmsg failed: " << strerror(errno));
+        return -1;
+    }
+    return rc;
+}
+
+ReceivedDatagram ReceiveBatch::datagram(size_t index) const {
+    ReceivedDatagram datagram{};
+    datagram.data = &buffers[index * buffer_size];
+    datagram.length = headers[index].msg_len;
+    datagram.truncated = (headers[index].msg_hdr.msg_flags & MSG_TRUNC) != 0 || datagram.length > buffer_size;
+    datagram.source = sources[index];
+    return datagram;
+}
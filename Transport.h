@@ -0,0 +1,95 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "ConfigEntry.h"
+
+#define SEND_BATCH_CAPACITY 1024 // sendmmsg accepts at most UIO_MAXIOV datagrams per call
+#define RECEIVE_BATCH_CAPACITY 64
+
+// One payload and every address it goes to: the unit a SendBatch hands to a send offload
+struct OutgoingDatagrams {
+    std::string payload;
+    std::vector<sockaddr_in> destinations;
+};
+
+// Takes the datagrams over (e.g. queues them for a send thread) and returns true, or returns
+// false to have the caller send them itself
+typedef std::function<bool(OutgoingDatagrams &)> SendOffload;
+
+// While set, SendBatch::flush() offers its datagrams to offload instead of calling sendmmsg.
+// Not synchronized: set it before the threads that send start and clear it after they stop.
+void set_send_offload(const SendOffload &offload);
+
+// Collects (peer, payload) pairs and hands them to the kernel with as few sendmmsg calls as
+// possible. Payloads are referenced, not copied, so they must stay alive until flush().
+class SendBatch {
+public:
+    // A direct batch always calls sendmmsg itself; that is what the offload's own sender uses
+    explicit SendBatch(int socket_file_descriptor, size_t capacity = SEND_BATCH_CAPACITY, bool direct = false);
+
+    ~SendBatch();
+
+    void add(const ConfigEntry &entry, const std::string &payload);
+
+    void add(const sockaddr_in &address, const char *data, size_t length);
+
+    // Returns the number of datagrams the kernel accepted
+    size_t flush();
+
+    size_t size() const { return pending; }
+
+private:
+    int socket_file_descriptor;
+    size_t pending;
+    bool direct;
+    std::vector<mmsghdr> headers;
+    std::vector<iovec> vectors;
+    OutgoingDatagrams staging; // Swapped with the offload's slot, so buffers circulate instead of reallocating
+
+    bool offload_pending();
+
+    SendBatch(const SendBatch &) = delete;
+
+    SendBatch &operator=(const SendBatch &) = delete;
+};
+
+// View of one datagram inside a ReceiveBatch; valid until the next receive()
+struct ReceivedDatagram {
+    const char *data;
+    size_t length; // Size on the wire, which exceeds the buffer when truncated
+    bool truncated; // Larger than the buffer; data holds only the first buffer_size bytes
+    sockaddr_in source;
+};
+
+// Drains up to capacity datagrams per wakeup with recvmmsg into buffers that are reused
+// across calls, so the receive path never copies or allocates per datagram.
+class ReceiveBatch {
+public:
+    ReceiveBatch(size_t capacity, size_t buffer_size);
+
+    // Non-blocking; returns the number of datagrams received, 0 when none are queued, -1 on error
+    int receive(int socket_file_descriptor);
+
+    ReceivedDatagram datagram(size_t index) const;
+
+    size_t capacity() const { return headers.size(); }
+
+private:
+    size_t buffer_size;
+    std::vector<char> buffers;
+    std::vector<mmsghdr> headers;
+    std::vector<iovec> vectors;
+    std::vector<sockaddr_in> sources;
+
+    ReceiveBatch(const ReceiveBatch &) = delete;
+
+    ReceiveBatch &operator=(const ReceiveBatch &) = delete;
+};
+
+#endif // TRANSPORT_H
@@ -1,5 +1,7 @@
 #include "Utility.h"
 #include "Message.h"
+#include "Transport.h"
+#include "Log.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -9,84 +11,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-#include <set>
 #include <cmath>
 #include <memory>
 
-std::unordered_map<std::string, std::string> parse_message(const std::string &message) {
-    std::unordered_map<std::string, std::string> map;
-    std::set<std::string> seen_keys;
-    std::string key, value;
-    bool in_quote = false;
-    bool is_key = true;
-
-    std::set<std::string> allowed_keys = {
-            "time",
-            "msg",
-            "type",
-            "move",
-            "to_port",
-            "from_port",
-            "ttl",
-            "version",
-            "flags",
-            "location",
-            "sequence_number",
-            "send-path"
-    };\
-    std::set<std::string> required_keys = {
-            "time", "to_port", "from_port", "ttl", "version", "flags", "location", "sequence_number"
-    };
-
-    for (size_t i = 0; i < message.length(); ++i) {
-        if (message[i] == '"' && (i == 0 || message[i - 1] != '\\')) {
-            in_quote = !in_quote;
-        } else if (message[i] == ':' && !in_quote) {
-            is_key = false;
-        } else if ((message[i] == ' ' && !in_quote && is_key) || (message[i] == ' ' && in_quote)) {
-            // Allow spaces within quotes for msg value
-            value += message[i]; // Add space to value even outside quotes for key
-        }
-
-        // Handle end of message or end of value segment
-        if (!in_quote && (message[i] == ' ' || i == message.length() - 1)) {
-            if (i == message.length() - 1 && message[i] != ' ') {
-                value += message[i]; // Ensure last character is included if not space
-            }
-            if (!key.empty()) {
-                if (seen_keys.find(key) != seen_keys.end()) {
-                    std::cerr << key << " found more than once" << std::endl;
-                    return {}; // Duplicate key
-                }
-                if (allowed_keys.find(key) == allowed_keys.end()) {
-                    std::cerr << key << " is not in protocol" << std::endl;
-                    return {}; // Unknown key
-                }
-                map[key] = value;
-                seen_keys.insert(key);
-            }
-            key.clear();
-            value.clear();
-            is_key = true; // Ready to read next key
-        } else {
-            // Accumulate characters into key or value
-            if (is_key) key += message[i];
-            else if (message[i] == ':' && !in_quote) continue;
-            else if (message[i] != 32) value += message[i];
-        }
-    }
-
-    // Check if any required key is missing
-    for (const auto &required_key: required_keys) {
-        if (seen_keys.find(required_key) == seen_keys.end()) {
-            std::cerr << required_key << " is missing" << std::endl;
-            return {}; // Missing key
-        }
-    }
-
-    return map;
-}
-
+static int send_socket_file_descriptor = -1;
 
 std::vector<ConfigEntry> read_config(const std::string &file_path) {
     std::vector<ConfigEntry> config;
@@ -102,7 +30,12 @@ std::vector<ConfigEntry> read_config(const std::string &file_path) {
         ushort port;
         int location;
         if (iss >> ip >> port >> location) {
-            config.emplace_back(ip, port, location, 0, 0);
+            ConfigEntry entry(ip, port, location, 0, 0);
+            if (!resolve_config_entry(entry)) {
+                std::cerr << "Invalid address in config: " << ip << std::endl;
+                continue;
+            }
+            config.push_back(entry);
         }
     }
     return config;
@@ -113,24 +46,28 @@ long unsigned int get_current_UTC_time() {
 }
 
 
-void send_message(const std::string &ip, ushort port, const std::string &message) {
-    int socket_file_descriptor = socket(AF_INET, SOCK_DGRAM, 0);
-    if (socket_file_descriptor < 0) {
+bool resolve_config_entry(ConfigEntry &entry) {
+    memset(&entry.address, 0, sizeof(entry.address));
+    entry.address.sin_family = AF_INET;
+    entry.address.sin_port = htons(entry.port);
+    return inet_pton(AF_INET, entry.ip.c_str(), &entry.address.sin_addr) == 1;
+}
+
+int setup_send_socket() {
+    if (send_socket_file_descriptor >= 0) return send_socket_file_descriptor;
+    send_socket_file_descriptor = socket(AF_INET, SOCK_DGRAM, 0);
+    if (send_socket_file_descriptor < 0) {
         std::cerr << "Error opening socket" << std::endl;
-        return;
+        exit(EXIT_FAILURE);
     }
-
-    struct sockaddr_in server_address{};
-    memset(&server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(port);
-    inet_pton(AF_INET, ip.c_str(), &server_address.sin_addr);
-
-    sendto(socket_file_descriptor, message.c_str(), message.length(), 0, (const struct sockaddr *) &server_address,
-           sizeof(server_address));
-    close(socket_file_descriptor);
+    return send_socket_file_descriptor;
 }
 
+void close_send_socket() {
+    if (send_socket_file_descriptor < 0) return;
+    close(send_socket_file_descriptor);
+    send_socket_file_descriptor = -1;
+}
 
 int setup_listen_socket(int listen_port) {
     int socket_file_descriptor = socket(AF_INET, SOCK_DGRAM, 0);
@@ -153,36 +90,111 @@ int setup_listen_socket(int listen_port) {
     return socket_file_descriptor;
 }
 
-void send_message_to_entry(const ConfigEntry &entry, const BasePacket &packet) {
-    std::string formatted_message = packet.serialize();
-    send_message(entry.ip, entry.port, formatted_message);
+void send_message_to_peer(const PeerTable &peers, int peer, const BasePacket &packet) {
+    // Through the shared batch, so it takes the same offload (send thread, coalescing) as the rest
+    const std::string &formatted_message = packet.encoded();
+    SendBatch &batch = shared_send_batch();
+    batch.add(peers.addresses[peer], formatted_message.data(), formatted_message.length());
+    batch.flush();
+}
+
+SendBatch &shared_send_batch() {
+    static thread_local SendBatch batch(setup_send_socket());
+    return batch;
 }
 
-std::pair<std::unique_ptr<Packet>, bool>
-process_incoming_message(std::unordered_map<std::basic_string<char>, std::basic_string<char>> map) {
-    try {
-        // Attempt to deserialize as a Message
-        Message message = Message::deserialize(map);
-        // Successfully deserialized a Message, return it with true
-        // C++11 does not have std::make_unique, so use std::unique_ptr constructor directly
-        return std::make_pair(std::unique_ptr<Message>(new Message(std::move(message))), true);
-    } catch (const std::exception &e) {
-        // Log or handle Message deserialization failure
-        std::cerr << "Message deserialization failed: " << e.what() << std::endl;
+size_t broadcast_packet(const PeerTable &peers, const BasePacket &packet, const std::function<bool(int)> &should_send) {
+    const std::string &formatted_message = packet.encoded();
+    SendBatch &batch = shared_send_batch();
+    for (int peer = 0; peer < peers.size(); ++peer) {
+        if (should_send(peer)) batch.add(peers.addresses[peer], formatted_message.data(), formatted_message.length());
+    }
+    return batch.flush();
+}
+
+size_t forward_packet(PeerTable &peers, int self, Packet &packet, int next_hop) {
+    packet.location = peers.locations[self];
+    packet.ttl -= 1;
+    packet.send_path.push_back(peers.ports[self]);
+    const std::string &formatted_message = packet.encoded();
+    SendBatch &batch = shared_send_batch();
+    if (next_hop != NO_PEER) {
+        LOG_DEBUG("Forwarding to " << peers.ports[next_hop] << ": " << packet.printable());
+        batch.add(peers.addresses[next_hop], formatted_message.data(), formatted_message.length());
+        return batch.flush();
+    }
+
+    // Hops become bits by peer index, so the peers still to visit come out a word at a time
+    const std::vector<uint64_t> &on_path = peers.path_set(packet.send_path);
+    for (int first = 0; first < peers.size(); first += 64) {
+        uint64_t pending = ~on_path[static_cast<size_t>(first) / 64];
+        if (peers.size() - first < 64) pending &= (static_cast<uint64_t>(1) << (peers.size() - first)) - 1;
+        for (; pending != 0; pending &= pending - 1) {
+            int peer = first + __builtin_ctzll(pending);
+            LOG_DEBUG("Forwarding to " << peers.ports[peer] << ": " << packet.printable());
+            batch.add(peers.addresses[peer], formatted_message.data(), formatted_message.length());
+        }
     }
+    return batch.flush();
+}
+
+PacketKind classify_packet(const WireFields &fields) {
+    // The kind follows from which type-specific key is present, so no decode attempt is wasted
+    if (fields.has(KEY_MOVE)) return PacketKind::MoveCommand;
+    if (fields.has(KEY_MSG)) return PacketKind::Message;
+    if (fields.has(KEY_TYPE)) return PacketKind::Acknowledgement;
+    return PacketKind::Invalid;
+}
 
-    try {
-        // If Message deserialization fails, try as an Acknowledgement
-        Acknowledgement ack = Acknowledgement::deserialize(map);
-        // Successfully deserialized an Acknowledgement, return it with false
-        return std::make_pair(std::unique_ptr<Acknowledgement>(new Acknowledgement(std::move(ack))), false);
-    } catch (const std::exception &e) {
-        // Log or handle Acknowledgement deserialization failure
-        std::cerr << "Acknowledgement deserialization failed: " << e.what() << std::endl;
+const char *decode_status_name(DecodeStatus status) {
+    switch (status) {
+        case DecodeStatus::Ok:
+            return "ok";
+        case DecodeStatus::UnknownKind:
+            return "unknown packet kind";
+        case DecodeStatus::MissingSendPath:
+            return "send-path is missing";
+        case DecodeStatus::UnexpectedKind:
+            return "packet kind cannot be decoded here";
     }
-    std::cerr << "Deserialization failed: " << std::endl;
+    return "?";
+}
 
+void decode_datagram(const char *data, size_t length, DecodedDatagram &decoded) {
+    WireFields fields;
+    decoded.packet = nullptr;
+    decoded.parsed = parse_wire(data, length, fields);
+    if (!decoded.parsed) return;
+    decoded.kind = classify_packet(fields);
+    if (decoded.kind == PacketKind::MoveCommand) {
+        decoded.status = DecodeStatus::Ok;
+        decoded.move_port = fields.to_port;
+        decoded.move_location = fields.move;
+        if (fields.binary) decoded.move_text = MoveCommand::deserialize(fields).serialize();
+        else decoded.move_text.assign(fields.source.data, fields.source.length);
+        return;
+    }
+    decoded.status = process_incoming_message(fields, decoded.kind, decoded);
+}
 
-    // If both deserialization operations fail, return nullptr with false
-    return std::make_pair(std::unique_ptr<Packet>(nullptr), false);
+DecodeStatus process_incoming_message(const WireFields &fields, PacketKind kind, DecodedDatagram &decoded) {
+    switch (kind) {
+        case PacketKind::Message:
+            if (!fields.has(KEY_SEND_PATH)) return DecodeStatus::MissingSendPath;
+            decoded.message.assign(fields);
+            decoded.message.adopt_encoding(fields);
+            decoded.packet = &decoded.message;
+            return DecodeStatus::Ok;
+        case PacketKind::Acknowledgement:
+            if (!fields.has(KEY_SEND_PATH)) return DecodeStatus::MissingSendPath;
+            decoded.acknowledgement.assign(fields);
+            decoded.acknowledgement.adopt_encoding(fields);
+            decoded.packet = &decoded.acknowledgement;
+            return DecodeStatus::Ok;
+        case PacketKind::MoveCommand:
+            return DecodeStatus::UnexpectedKind;
+        case PacketKind::Invalid:
+            break;
+    }
+    return DecodeStatus::UnknownKind;
 }
@@ -7,10 +7,11 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <functional>
 
 #include "Message.h"
-
-std::unordered_map<std::string, std::string> parse_message(const std::string &message);
+#include "PeerTable.h"
+#include "Transport.h"
 
 std::vector<ConfigEntry> read_config(const std::string &file_path);
 
@@ -18,9 +19,74 @@ unsigned long get_current_UTC_time();
 
 int setup_listen_socket(int listen_port);
 
-void send_message_to_entry(const ConfigEntry &entry, const BasePacket &packet);
+int setup_send_socket();
+
+void close_send_socket();
+
+bool resolve_config_entry(ConfigEntry &entry);
+
+void send_message_to_peer(const PeerTable &peers, int peer, const BasePacket &packet);
+
+// A batch on the shared send socket for the calling thread, kept so its buffers are allocated
+// once. Whoever adds to it flushes it before returning, so it is always empty between uses.
+SendBatch &shared_send_batch();
+
+// Serializes the packet once and sends it to every peer accepted by should_send in one batch
+size_t broadcast_packet(const PeerTable &peers, const BasePacket &packet, const std::function<bool(int)> &should_send);
+
+// Relays a packet on from self: stamps this hop (location, ttl, send path) into it and sends it
+// to next_hop alone when one is given, else to every peer not already on its path. Returns the
+// number of datagrams sent.
+size_t forward_packet(PeerTable &peers, int self, Packet &packet, int next_hop = NO_PEER);
+
+enum class PacketKind {
+    Message,
+    Acknowledgement,
+    MoveCommand,
+    Invalid
+};
+
+enum class DecodeStatus {
+    Ok,
+    UnknownKind,
+    MissingSendPath,
+    UnexpectedKind
+};
+
+PacketKind classify_packet(const WireFields &fields);
+
+const char *decode_status_name(DecodeStatus status);
+
+// A datagram turned into owned values, with no drone state involved, so it can be decoded on
+// any thread and applied on the one that owns the state. The packet objects are kept and
+// refilled by every decode, so once their buffers have grown to the traffic's size a decode no
+// longer allocates; everything from one datagram is released together by the next decode.
+struct DecodedDatagram {
+    bool parsed;
+    PacketKind kind;
+    DecodeStatus status;
+    Packet *packet;                 // Message and Acknowledgement: one of the two below, else null
+    ushort move_port;               // MoveCommand: the drone that moves
+    int move_location;              // MoveCommand: where it moves to
+    std::string move_text;          // MoveCommand: printable form
+    Message message;
+    Acknowledgement acknowledgement;
+
+    DecodedDatagram() : parsed(false), kind(PacketKind::Invalid), status(DecodeStatus::UnknownKind), packet(nullptr),
+                        move_port(0), move_location(0),
+                        message(0, std::string(), 0, 0, 0, 0, 0, 0, 0, std::vector<ushort>()),
+                        acknowledgement(0, std::string(), 0, 0, 0, 0, 0, 0, 0, std::vector<ushort>()) {}
+
+private:
+    // packet points into this object
+    DecodedDatagram(const DecodedDatagram &) = delete;
+
+    DecodedDatagram &operator=(const DecodedDatagram &) = delete;
+};
+
+// Decodes a Message or Acknowledgement into decoded's own packet objects
+DecodeStatus process_incoming_message(const WireFields &fields, PacketKind kind, DecodedDatagram &decoded);
 
-std::pair<std::unique_ptr<Packet>, bool>
-process_incoming_message(std::unordered_map<std::basic_string<char>, std::basic_string<char>> map);
+void decode_datagram(const char *data, size_t length, DecodedDatagram &decoded);
 
 #endif
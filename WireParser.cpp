@@ -0,0 +1,219 @@
+#include "WireParser.h"
+#include "Log.h"
+#include "BinaryWire.h"
+#include <cstring>
+#include <climits>
+
+static const char *const key_names[KEY_COUNT] = {
+        "time",
+        "msg",
+        "type",
+        "move",
+        "to_port",
+        "from_port",
+        "ttl",
+        "version",
+        "flags",
+        "location",
+        "sequence_number",
+        "send-path",
+        "cum_ack",
+        "sack"
+};
+
+static const unsigned required_keys =
+        (1u << KEY_TIME) | (1u << KEY_TO_PORT) | (1u << KEY_FROM_PORT) | (1u << KEY_TTL) |
+        (1u << KEY_VERSION) | (1u << KEY_FLAGS) | (1u << KEY_LOCATION) | (1u << KEY_SEQUENCE_NUMBER);
+
+bool FieldView::equals(const char *literal) const {
+    size_t literal_length = std::strlen(literal);
+    return literal_length == length && std::memcmp(data, literal, length) == 0;
+}
+
+const char *wire_key_name(WireKey key) {
+    return key < KEY_COUNT ? key_names[key] : "?";
+}
+
+static int lookup_key(const FieldView &key) {
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        if (key.equals(key_names[i])) return i;
+    }
+    return -1;
+}
+
+static bool parse_integer(const FieldView &value, long long min, long long max, long long &out) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < value.length && (value.data[i] == '-' || value.data[i] == '+')) {
+        negative = value.data[i] == '-';
+        ++i;
+    }
+    if (i == value.length || value.length - i > 18) return false; // 18 digits cannot overflow long long
+    long long result = 0;
+    for (; i < value.length; ++i) {
+        char c = value.data[i];
+        if (c < '0' || c > '9') return false;
+        result = result * 10 + (c - '0');
+    }
+    out = negative ? -result : result;
+    return out >= min && out <= max;
+}
+
+static bool parse_hex(const FieldView &value, uint64_t &out) {
+    if (value.length == 0 || value.length > 16) return false;
+    out = 0;
+    for (size_t i = 0; i < value.length; ++i) {
+        char c = value.data[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) return false;
+        out = (out << 4) | static_cast<uint64_t>(digit);
+    }
+    return true;
+}
+
+static bool parse_send_path(const FieldView &value, WireFields &fields) {
+    fields.send_path_length = 0;
+    size_t start = 0;
+    while (start < value.length) {
+        size_t end = start;
+        while (end < value.length && value.data[end] != ',') ++end;
+        long long port;
+        if (!parse_integer(FieldView(value.data + start, end - start), 0, USHRT_MAX, port)) return false;
+        if (fields.send_path_length == WIRE_MAX_SEND_PATH) return false;
+        fields.send_path[fields.send_path_length++] = static_cast<ushort>(port);
+        start = end + 1;
+    }
+    return true;
+}
+
+static bool store_field(WireKey key, const FieldView &value, WireFields &fields) {
+    long long number = 0;
+    switch (key) {
+        case KEY_MSG:
+            fields.msg = value;
+            return true;
+        case KEY_TYPE:
+            fields.type = value;
+            return true;
+        case KEY_SEND_PATH:
+            return parse_send_path(value, fields);
+        case KEY_TIME:
+            if (!parse_integer(value, 0, LLONG_MAX, number)) return false;
+            fields.time = static_cast<unsigned long>(number);
+            return true;
+        case KEY_TO_PORT:
+        case KEY_FROM_PORT:
+            if (!parse_integer(value, 0, USHRT_MAX, number)) return false;
+            (key == KEY_TO_PORT ? fields.to_port : fields.from_port) = static_cast<ushort>(number);
+            return true;
+        case KEY_TTL:
+        case KEY_VERSION:
+        case KEY_FLAGS:
+            if (!parse_integer(value, SHRT_MIN, SHRT_MAX, number)) return false;
+            (key == KEY_TTL ? fields.ttl : key == KEY_VERSION ? fields.version : fields.flags) =
+                    static_cast<short>(number);
+            return true;
+        case KEY_SACK:
+            return parse_hex(value, fields.sack);
+        case KEY_CUMULATIVE_ACK:
+            if (!parse_integer(value, 0, INT_MAX, number)) return false;
+            fields.cumulative_ack = static_cast<int>(number);
+            return true;
+        case KEY_LOCATION:
+        case KEY_SEQUENCE_NUMBER:
+        case KEY_MOVE:
+            if (!parse_integer(value, INT_MIN, INT_MAX, number)) return false;
+            (key == KEY_LOCATION ? fields.location : key == KEY_SEQUENCE_NUMBER ? fields.sequence_number
+                                                                              : fields.move) =
+                    static_cast<int>(number);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool parse_wire(const char *data, size_t length, WireFields &fields) {
+    if (is_binary_wire(data, length)) return parse_binary_wire(data, length, fields);
+
+    fields.present = 0;
+    fields.binary = false;
+    fields.msg = FieldView();
+    fields.type = FieldView();
+    fields.send_path_length = 0;
+    fields.sack = 0;
+
+    // Tolerate a trailing newline from line-oriented senders such as netcat
+    while (length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\r')) --length;
+    fields.source = FieldView(data, length);
+
+    size_t i = 0;
+    while (i < length) {
+        if (data[i] == ' ') {
+            ++i;
+            continue;
+        }
+
+        // A token runs to the next space that is not inside a quoted value
+        size_t token_start = i;
+        size_t colon = length;
+        bool in_quote = false;
+        for (; i < length; ++i) {
+            char c = data[i];
+            if (c == '"' && (i == 0 || data[i - 1] != '\\')) {
+                in_quote = !in_quote;
+            } else if (c == ':' && !in_quote && colon == length) {
+                colon = i;
+            } else if (c == ' ' && !in_quote) {
+                break;
+            }
+        }
+        if (in_quote) {
+            LOG_WARN("Unterminated quote");
+            return false;
+        }
+
+        size_t key_end = colon < i ? colon : i;
+        FieldView key(data + token_start, key_end - token_start);
+        FieldView value;
+        if (colon < i) value = FieldView(data + colon + 1, i - colon - 1);
+
+        int index = lookup_key(key);
+        if (index < 0) {
+            LOG_WARN(log_bytes(key.data, key.length) << " is not in protocol");
+            return false; // Unknown key
+        }
+        WireKey wire_key = static_cast<WireKey>(index);
+        if (fields.has(wire_key)) {
+            LOG_WARN(key_names[index] << " found more than once");
+            return false; // Duplicate key
+        }
+        if (!store_field(wire_key, value, fields)) {
+            LOG_WARN(key_names[index] << " has an invalid value");
+            return false;
+        }
+        fields.present |= 1u << wire_key;
+        fields.raw[wire_key] = value;
+    }
+
+    // Check if any required key is missing
+    unsigned missing = required_keys & ~fields.present;
+    if (missing != 0) {
+        for (int k = 0; k < KEY_COUNT; ++k) {
+            if (missing & (1u << k)) {
+                LOG_WARN(key_names[k] << " is missing");
+                break;
+            }
+        }
+        return false; // Missing key
+    }
+    if (fields.version == WIRE_BINARY_VERSION) {
+        // The version selects the encoding, so a text datagram cannot claim the binary one
+        LOG_WARN("version " << WIRE_BINARY_VERSION << " is only valid in binary datagrams");
+        return false;
+    }
+    return true;
+}
+
+bool parse_wire(const std::string &message, WireFields &fields) {
+    return parse_wire(message.data(), message.length(), fields);
+}
@@ -0,0 +1,81 @@
+#ifndef WIRE_PARSER_H
+#define WIRE_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+typedef unsigned short ushort;
+
+#define WIRE_MAX_SEND_PATH 64
+
+// Non-owning view over a slice of a receive buffer (the tree is C++11, so no std::string_view).
+struct FieldView {
+    const char *data;
+    size_t length;
+
+    FieldView() : data(nullptr), length(0) {}
+
+    FieldView(const char *data, size_t length) : data(data), length(length) {}
+
+    bool empty() const { return length == 0; }
+
+    bool equals(const char *literal) const;
+
+    std::string str() const { return std::string(data, length); }
+};
+
+enum WireKey {
+    KEY_TIME,
+    KEY_MSG,
+    KEY_TYPE,
+    KEY_MOVE,
+    KEY_TO_PORT,
+    KEY_FROM_PORT,
+    KEY_TTL,
+    KEY_VERSION,
+    KEY_FLAGS,
+    KEY_LOCATION,
+    KEY_SEQUENCE_NUMBER,
+    KEY_SEND_PATH,
+    KEY_CUMULATIVE_ACK,
+    KEY_SACK,
+    KEY_COUNT
+};
+
+// Typed result of a single pass over a datagram. Text fields (msg, type) point into the
+// caller's buffer, so the buffer must outlive the struct.
+struct WireFields {
+    unsigned present;
+    unsigned long time;
+    ushort to_port;
+    ushort from_port;
+    short ttl;
+    short version;
+    short flags;
+    int location;
+    int sequence_number;
+    int move;
+    int cumulative_ack;        // ACKs: every sequence up to this one has arrived
+    uint64_t sack;             // ACKs: bit i means cumulative_ack + 1 + i has arrived
+    FieldView msg;
+    FieldView type;
+    ushort send_path[WIRE_MAX_SEND_PATH];
+    size_t send_path_length;
+    bool binary;               // Decoded from the binary encoding (see BinaryWire.h)
+    FieldView source;          // The whole datagram, minus any trailing newline
+    FieldView raw[KEY_COUNT];  // Unparsed value of each present key, pointing into source
+
+    bool has(WireKey key) const { return (present & (1u << key)) != 0; }
+};
+
+const char *wire_key_name(WireKey key);
+
+// Parses "key:value key:\"quoted value\" ..." into fields without allocating. Rejects
+// duplicate, unknown and missing required keys like the old map-based parser did. Binary
+// datagrams are recognised by their first byte and handed to parse_binary_wire().
+bool parse_wire(const char *data, size_t length, WireFields &fields);
+
+bool parse_wire(const std::string &message, WireFields &fields);
+
+#endif // WIRE_PARSER_H
@@ -1,331 +1,652 @@
-#include <algorithm>
-#include <cmath>
-
 #include "Utility.h"
 #include "Message.h"
+#include "Transport.h"
+#include "BinaryWire.h"
+#include "Coalescer.h"
+#include "CommandChannel.h"
+#include "EventLoop.h"
+#include "Grid.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Options.h"
+#include "PeerTable.h"
+#include "Pipeline.h"
+#include "Reachability.h"
+#include "RetransmitStore.h"
+#include "RouteCache.h"
+#include "SeenCache.h"
+#include <algorithm>
+#include <deque>
 #include <iostream>
-#include <limits>
-#include <sys/select.h>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/signalfd.h>
 #include <netinet/in.h>
 #include <functional>
-#include <mutex>
 
 #define BUFFER_SIZE 1024
 #define PROTOCOL_VERSION 8
 #define PROTOCOL_TTL 5
-#define ROWS 4
-#define COLS 4
+#define RETRANSMIT_CHECK_MS 50
+
+// Everything the receive path needs to know about this drone and its peers
+struct DroneState {
+    DroneState(const DroneOptions &options, const RetransmitOptions &retransmit_options)
+            : listen_port(0), self(NO_PEER),
+              wire_version(options.binary_wire ? WIRE_BINARY_VERSION : PROTOCOL_VERSION),
+              grid(options.rows, options.cols, options.range),
+              retransmit_store(retransmit_options, EventLoop::now_ms()),
+              seen(options.seen_capacity, options.seen_window_ms, EventLoop::now_ms()),
+              routes(options.route_ttl_ms),
+              reply(0, "ACK", 0, 0, 0, 0, 0, 0, 0, std::vector<ushort>()),
+              reroute(0, "", 0, 0, 0, 0, 0, 0, 0, std::vector<ushort>()),
+              ack_delay_ms(options.ack_delay_ms),
+              ack_every(options.ack_delay_ms == 0 ? 1 : std::min<size_t>(options.ack_every, SLIDING_WINDOW_SIZE)) {}
+
+    PeerTable peers;
+    ushort listen_port;
+    int self; // This drone's index in peers
+    short wire_version; // Version, and so encoding, of the packets this drone originates
+    Grid grid;
+    RetransmitStore retransmit_store;
+    SeenCache seen; // Packets already relayed, or sent from here, so flood copies are not relayed again
+    RouteCache routes;
+    Reachability reachability; // Kept current through moves, so each one can be diffed
+    std::vector<std::deque<std::string>> held_messages; // Per destination, waiting for its send window
+    std::vector<uint64_t> send_times; // First send of each in-flight message, SLIDING_WINDOW_SIZE per destination
+    Acknowledgement reply; // Refilled for every ACK this drone sends, so replying does not allocate
+
+    // Rerouted copies sent after a move: each is encoded in reroute and appended to
+    // reroute_wires, which holds them all until the one batch flush. Reused across moves.
+    struct Reroute {
+        int first_hop;
+        size_t offset, length; // Within reroute_wires
+    };
+    Message reroute;
+    std::string reroute_wires;
+    std::vector<Reroute> reroutes;
+
+    // Delayed ACKs: messages from each sender not yet acknowledged, and when their ACK is due
+    struct PendingAck {
+        size_t messages;
+        uint64_t due_ms;
+        int sequence_number; // Latest one delivered
+        bool binary;         // Encoding it arrived in
+    };
+    uint64_t ack_delay_ms;
+    size_t ack_every; // 1 when ack_delay_ms is 0, so every message is acknowledged at once
+    std::vector<PendingAck> pending_acks;
+
+    uint64_t &send_time(int destination, int sequence_number) {
+        return send_times[static_cast<size_t>(destination) * SLIDING_WINDOW_SIZE +
+                          static_cast<size_t>(sequence_number) % SLIDING_WINDOW_SIZE];
+    }
 
-std::vector<Message> message_store;
-std::mutex message_store_mutex;
+    int &location() { return peers.locations[self]; }
 
+    void move_peer(int peer, int new_location) {
+        grid.move_peer(peer, peers.locations[peer], new_location);
+        peers.locations[peer] = new_location;
+    }
+};
 
-void resend_messages(std::vector<ConfigEntry> &config_entries) {
-    std::lock_guard<std::mutex> lock(message_store_mutex);
-    for (auto it = message_store.begin(); it != message_store.end();) {
-        if (it->ttl <= 0) {
-            it = message_store.erase(it);
-            std::cout << "Out of time message erased from queue." << std::endl;
-        } else {
-            // Assume that send_message_to_entry is capable of checking the network status or other conditions
-            --(it->ttl);
-            std::cout << it->serialize() << std::endl;
-            for (auto &entry: config_entries) {
-                if (entry.port != it->from_port) {
-                    send_message_to_entry(entry, *it);
+
+void release_held_messages(DroneState &state, int destination);
+
+// The one peer a packet for destination should go to, or NO_PEER to flood it: the destination
+// itself when it is in range, else a fresh learned next hop that is still in range
+int route_to(DroneState &state, int destination) {
+    if (!state.routes.enabled() || destination == NO_PEER) return NO_PEER;
+    const std::vector<int> &locations = state.peers.locations;
+    if (state.grid.in_range(state.location(), locations[destination])) return destination;
+    int next_hop = state.routes.next_hop(destination, EventLoop::now_ms());
+    if (next_hop != NO_PEER && state.grid.in_range(state.location(), locations[next_hop])) return next_hop;
+    return NO_PEER;
+}
+
+void resend_messages(DroneState &state) {
+    // All due messages go out as one batch. Each stored message keeps its own encoding, where
+    // a resend only patches the ttl, so the batch can reference it until the flush.
+    SendBatch &batch = shared_send_batch();
+    size_t expired = 0;
+    std::vector<int> reopened;
+    size_t resent = state.retransmit_store.collect_due(
+            EventLoop::now_ms(),
+            [&](const Message &message) {
+                // A resend floods, and the route the first copy took is no longer trusted
+                int destination = state.peers.index_of(message.to_port);
+                if (destination != NO_PEER) state.routes.forget(destination);
+                state.seen.insert(SeenCache::make_key(false, message.from_port, message.to_port,
+                                                      message.sequence_number, false, true), EventLoop::now_ms());
+                const std::string &payload = message.encoded();
+                for (int peer = 0; peer < state.peers.size(); ++peer) {
+                    if (state.peers.ports[peer] != message.from_port) {
+                        batch.add(state.peers.addresses[peer], payload.data(), payload.length());
+                    }
                 }
-            }
-            ++it;
-        }
+            },
+            [&](const Message &message) {
+                // Given up on: the slot in the destination's send window is free again
+                ++expired;
+                int destination = state.peers.index_of(message.to_port);
+                if (destination != NO_PEER && state.peers.send_windows[destination].resolve(message.sequence_number)) {
+                    reopened.push_back(destination);
+                }
+            });
+    batch.flush();
+    metrics_add(COUNTER_RESENT, resent);
+    metrics_add(COUNTER_EXPIRED, expired);
+    if (resent > 0) LOG_INFO("Resent " << resent << " unacknowledged message(s).");
+    if (expired > 0) LOG_INFO(expired << " out of time message(s) erased from queue.");
+    for (int destination: reopened) release_held_messages(state, destination);
+}
+
+// Called after a move. Each stored message whose destination the move made reachable (over any
+// number of hops) goes out once more, to the neighbor that starts the new shortest path, with
+// its retry schedule and TTL left alone. Messages whose reachability did not change just wait
+// for their own timeout, so a move that connects nothing new sends nothing. The copy is flagged
+// as rerouted, because the relays on the new path may have seen, and still remember, the first.
+void resend_newly_reachable(DroneState &state) {
+    PeerTable &peers = state.peers;
+    state.reachability.update(state.grid, peers.locations, state.self);
+    if (!state.reachability.gained_any()) return;
+    state.reroute_wires.clear();
+    state.reroutes.clear();
+    state.retransmit_store.for_each([&](const Message &message) {
+        int destination = peers.index_of(message.to_port);
+        if (destination == NO_PEER || !state.reachability.gained(destination)) return;
+        Message &copy = state.reroute;
+        copy = message;
+        copy.add_flag(PACKET_FLAG_REROUTED);
+        state.seen.insert(SeenCache::make_key(false, copy.from_port, copy.to_port, copy.sequence_number, true,
+                                              copy.has_flag(PACKET_FLAG_RETRANSMITTED)), EventLoop::now_ms());
+        const std::string &payload = copy.encoded();
+        state.reroutes.push_back({state.reachability.first_hop(destination), state.reroute_wires.size(),
+                                  payload.length()});
+        state.reroute_wires += payload;
+    });
+    // Only batched once reroute_wires has stopped growing, since growing it moves the copies
+    SendBatch &batch = shared_send_batch();
+    for (const DroneState::Reroute &reroute: state.reroutes) {
+        batch.add(peers.addresses[reroute.first_hop], state.reroute_wires.data() + reroute.offset, reroute.length);
+    }
+    batch.flush();
+    size_t resent = state.reroutes.size();
+    metrics_add(COUNTER_REROUTED, resent);
+    if (resent > 0) LOG_INFO("Resent " << resent << " message(s) toward newly reachable drones.");
+}
+
+// Broadcasts text as the next message in the destination's send window and keeps it for resends
+void originate_message(DroneState &state, int destination, const std::string &text) {
+    PeerTable &peers = state.peers;
+    int sequence_number = peers.send_windows[destination].open();
+    Message message = Message(get_current_UTC_time(), text, peers.ports[destination], state.listen_port,
+                              PROTOCOL_TTL,
+                              state.wire_version, 0, state.location(), sequence_number,
+                              std::vector<ushort>{state.listen_port});
+    const int self = state.self;
+    state.send_time(destination, sequence_number) = metrics_now_ns();
+    state.seen.insert(SeenCache::make_key(false, state.listen_port, peers.ports[destination], sequence_number),
+                      EventLoop::now_ms());
+    int next_hop = route_to(state, destination);
+    broadcast_packet(peers, message, [self, next_hop](int peer) {
+        return next_hop != NO_PEER ? peer == next_hop : peer != self;
+    });
+    if (next_hop != NO_PEER) metrics_add(COUNTER_ROUTED);
+    metrics_add(COUNTER_ORIGINATED);
+    if (!state.retransmit_store.insert(message, EventLoop::now_ms())) {
+        LOG_WARN("Resend store is full; message will not be retransmitted");
+        peers.send_windows[destination].resolve(sequence_number);
+    }
+}
+
+// Sends right away while the destination's window has room, otherwise holds the message in order
+void send_new_message(DroneState &state, int destination, const std::string &text) {
+    std::deque<std::string> &held = state.held_messages[destination];
+    if (held.empty() && !state.peers.send_windows[destination].full()) {
+        originate_message(state, destination, text);
+        return;
     }
+    held.push_back(text);
+    metrics_add(COUNTER_HELD);
+    LOG_INFO("Send window to " << state.peers.ports[destination] << " is full; " << held.size()
+                               << " message(s) waiting");
 }
 
-void remove_message_if_acked(const Packet &acknowledgement_packet) {
-    std::lock_guard<std::mutex> lock(message_store_mutex);
-    auto it = std::remove_if(message_store.begin(), message_store.end(),
-                             [&acknowledgement_packet](const Packet &stored_packet) {
-                                 return stored_packet.sequence_number == acknowledgement_packet.sequence_number &&
-                                        stored_packet.from_port == acknowledgement_packet.to_port &&
-                                        // Note: 'to_port' of ack should match 'from_port' of the message
-                                        stored_packet.to_port == acknowledgement_packet.from_port;   // and vice versa
-                             });
-    if (it != message_store.end()) {
-        message_store.erase(it, message_store.end());
-        std::cout << "ACK received, message removed: Seq #" << acknowledgement_packet.sequence_number << std::endl;
+void release_held_messages(DroneState &state, int destination) {
+    std::deque<std::string> &held = state.held_messages[destination];
+    while (!held.empty() && !state.peers.send_windows[destination].full()) {
+        originate_message(state, destination, held.front());
+        held.pop_front();
     }
 }
 
-int load_and_validate_config(const std::string &config_file_path, std::vector<ConfigEntry> &config, ushort &listen_port,
-                             ushort &sendtoPort, int &location) {
-    config = read_config(config_file_path);
-
-    sendtoPort = 0;
-    location = -1;
-    std::cout << "Config:" << std::endl;
-    bool is_valid = false;
-    for (const auto &entry: config) {
-        if (entry.port == listen_port) {
-            location = entry.location;
-            is_valid = true;
-            std::cout << entry.port << " " << entry.port << " " << entry.location << " *" << std::endl;
-        } else std::cout << entry.port << " " << entry.port << " " << entry.location << std::endl;
-    }
-    if (is_valid) return 0;
+void settle_message(DroneState &state, int destination, int sequence_number, size_t &settled) {
+    if (state.retransmit_store.acknowledge(state.listen_port, state.peers.ports[destination], sequence_number)) {
+        LOG_INFO("ACK received, message removed: Seq #" << sequence_number);
+        metrics_record(HISTOGRAM_ACK_ROUND_TRIP_US,
+                       (metrics_now_ns() - state.send_time(destination, sequence_number)) / 1000);
+    }
+    if (state.peers.send_windows[destination].resolve(sequence_number)) ++settled;
+}
+
+// Applies an ACK from destination to its send window and the resend store. Returns the number
+// of messages it newly acknowledged; 0 means the ACK was a duplicate.
+size_t process_acknowledgement(DroneState &state, int destination, const Acknowledgement &acknowledgement) {
+    SendWindow &window = state.peers.send_windows[destination];
+    size_t settled = 0;
+    settle_message(state, destination, acknowledgement.sequence_number, settled);
+    int cumulative = acknowledgement.cumulative_ack;
+    if (cumulative != NO_CUMULATIVE_ACK && cumulative < window.next) {
+        // base is always in flight, so each settle moves it forward
+        while (window.base < window.next && window.base <= cumulative) {
+            settle_message(state, destination, window.base, settled);
+        }
+        int highest_selected = cumulative;
+        for (int bit = 0; bit < SLIDING_WINDOW_SIZE && bit < window.next - cumulative - 1; ++bit) {
+            if ((acknowledgement.sack >> bit) & 1) {
+                highest_selected = cumulative + 1 + bit;
+                settle_message(state, destination, highest_selected, settled);
+            }
+        }
+        // Messages missing below one that arrived were most likely lost, so resend just those
+        // instead of waiting out their timeouts
+        bool expedited = false;
+        uint64_t now = EventLoop::now_ms();
+        for (int sequence_number = std::max(window.base, cumulative + 1);
+             sequence_number < highest_selected; ++sequence_number) {
+            if (window.in_flight(sequence_number) &&
+                state.retransmit_store.expedite(state.listen_port, state.peers.ports[destination], sequence_number,
+                                                now)) {
+                expedited = true;
+            }
+        }
+        if (expedited) resend_messages(state);
+    }
+    release_held_messages(state, destination);
+    return settled;
+}
+
+int load_and_validate_config(const std::string &config_file_path, PeerTable &peers, ushort listen_port, int &self) {
+    peers = PeerTable(read_config(config_file_path));
+
+    LOG_INFO("Config:");
+    self = peers.index_of(listen_port);
+    for (int peer = 0; peer < peers.size(); ++peer) {
+        LOG_INFO(peers.ports[peer] << " " << peers.ports[peer] << " " << peers.locations[peer]
+                                   << (peer == self ? " *" : ""));
+    }
+    if (self != NO_PEER) return 0;
     std::cerr << "Port not in config" << std::endl;
     return 1;
 
 }
 
-void print_config(std::vector<ConfigEntry> &config, ushort &listen_port) {
-    std::cout << "Config:" << std::endl;
-    for (const auto &entry: config) {
-        if (entry.port == listen_port) {
-            std::cout << entry.ip << " " << entry.port << " " << entry.location << " *" << std::endl;
-        } else std::cout << entry.ip << " " << entry.port << " " << entry.location << std::endl;
+void print_config(const PeerTable &peers, int self) {
+    LOG_INFO("Config:");
+    for (int peer = 0; peer < peers.size(); ++peer) {
+        LOG_INFO(peers.ips[peer] << " " << peers.ports[peer] << " " << peers.locations[peer]
+                                 << (peer == self ? " *" : ""));
     }
 }
 
-int find_distance(const int rows, const int cols, const int location, const Packet &packet) {
-    const int r0 = (location - 1) / rows;
-    const int c0 = (location - 1) % cols;
-
-    const int r = (packet.location - 1) / rows;
-    const int c = (packet.location - 1) % cols;
+// Sends sender one ACK covering everything its receive window holds: the cumulative ack and the
+// selective bitmap settle every message delivered so far, however many the ACK was delayed for
+void send_acknowledgement(DroneState &state, int sender) {
+    PeerTable &peers = state.peers;
+    ReceiveWindow &window = peers.receive_windows[sender];
+    DroneState::PendingAck &pending = state.pending_acks[sender];
+    Acknowledgement &ack = state.reply;
+    ack.reset(get_current_UTC_time(), peers.ports[sender], state.listen_port, PROTOCOL_TTL,
+              // Reply in the encoding the message arrived in, so text-only senders can read it
+              pending.binary ? WIRE_BINARY_VERSION : PROTOCOL_VERSION, 0, state.location(),
+              pending.sequence_number);
+    ack.send_path.assign(1, state.listen_port);
+    ack.cumulative_ack = window.cumulative;
+    ack.sack = window.bitmap;
+    // The message just came in, so the route back to its sender is usually known
+    int next_hop = route_to(state, sender);
+    if (next_hop != NO_PEER) {
+        send_message_to_peer(peers, next_hop, ack);
+        metrics_add(COUNTER_ROUTED);
+    } else {
+        const std::vector<uint64_t> &in_range = state.grid.neighbors(state.location(), peers.locations);
+        broadcast_packet(peers, ack, [&](int peer) {
+            // Send ACK if within range
+            return peer != state.self && Grid::has_peer(in_range, peer);
+        });
+    }
+    state.seen.insert(SeenCache::make_key(true, ack.from_port, ack.to_port, ack.sequence_number),
+                      EventLoop::now_ms());
+    metrics_add(COUNTER_ACKS_SENT);
+    pending.messages = 0;
+}
 
-    return static_cast<int>(std::sqrt((r - r0) * (r - r0) + (c - c0) * (c - c0)));
+// Sends the delayed ACKs whose delay has run out by now_ms
+void send_due_acknowledgements(DroneState &state, uint64_t now_ms) {
+    for (int sender = 0; sender < state.peers.size(); ++sender) {
+        const DroneState::PendingAck &pending = state.pending_acks[sender];
+        if (pending.messages > 0 && now_ms >= pending.due_ms) send_acknowledgement(state, sender);
+    }
 }
 
-void forward_packet(std::vector<ConfigEntry> &config_entries, ushort listen_port, int location, Packet &packet) {
-    packet.location = location;
-    packet.ttl -= 1;
-    packet.send_path.push_back(listen_port);
-    for (const auto &entry: config_entries) {
-        bool should_forward = true;
-        for (auto port: packet.send_path) {
-            if (port == entry.port) {
-                should_forward = false;
-                break;
-            }
+// Applies one decoded datagram to the drone state. Runs on the thread that owns the state.
+void apply_datagram(DroneState &state, DecodedDatagram &decoded) {
+    if (!decoded.parsed) {
+        metrics_add(COUNTER_PARSE_ERRORS);
+        LOG_WARN("Parsing Error");
+        return;
+    }
+    PacketKind kind = decoded.kind;
+    if (kind == PacketKind::MoveCommand) {
+        int target = state.peers.index_of(decoded.move_port);
+        if (target != NO_PEER) {
+            state.move_peer(target, decoded.move_location);
+        }
+        metrics_add(COUNTER_MOVES);
+        LOG_INFO("Moving: " << decoded.move_text);
+        print_config(state.peers, state.self);
+        resend_newly_reachable(state);
+        return;
+    }
+    if (decoded.status != DecodeStatus::Ok) { // Check if message is valid
+        metrics_add(COUNTER_PARSE_ERRORS);
+        LOG_WARN("Deserialization failed: " << decode_status_name(decoded.status));
+        return;
+    }
+    Packet &packet = *decoded.packet;
+    bool isMsg = kind == PacketKind::Message;
+    // Check if message is within range and ttl
+    if (!state.grid.in_range(state.location(), packet.location)) {
+        metrics_add(COUNTER_OUT_OF_RANGE);
+        return;
+    }
+    if (packet.ttl < 0) {
+        metrics_add(COUNTER_TTL_EXPIRED);
+        return;
+    }
+
+    PeerTable &peers = state.peers;
+    // Every copy teaches the way back to the drones on its path, duplicates included
+    state.routes.learn(peers, state.self, packet.send_path, EventLoop::now_ms());
+    if (state.listen_port == packet.to_port) {
+        // Is message/ack meant for current drone
+        int sender = peers.index_of(packet.from_port);
+        if (sender == NO_PEER) {
+            LOG_WARN("Sender " << packet.from_port << " not in config");
+            return;
         }
-        if (entry.port != listen_port && should_forward) {
-            std::cout << "Forwarding to " << entry.port << ": " << packet.serialize() << std::endl;
-            send_message_to_entry(entry, packet);
+        if (isMsg) { // If it is a message
+            // The window keeps out-of-order arrivals, so only true repeats are dropped
+            ReceiveWindow &window = peers.receive_windows[sender];
+            if (!window.accept(packet.sequence_number)) {
+                metrics_add(COUNTER_DUPLICATE_MESSAGES);
+                LOG_DEBUG("Duplicate Message: " << window.cumulative << ", " << packet.printable());
+                return;
+            }
+            metrics_add(COUNTER_DELIVERED);
+            LOG_INFO(packet.printable());
+            DroneState::PendingAck &pending = state.pending_acks[sender];
+            if (pending.messages++ == 0) pending.due_ms = EventLoop::now_ms() + state.ack_delay_ms;
+            pending.sequence_number = packet.sequence_number;
+            pending.binary = packet.binary();
+            if (pending.messages >= state.ack_every) send_acknowledgement(state, sender);
+        } else {
+            const Acknowledgement &acknowledgement = static_cast<const Acknowledgement &>(packet);
+            if (process_acknowledgement(state, sender, acknowledgement) == 0) {
+                metrics_add(COUNTER_DUPLICATE_ACKS);
+                LOG_DEBUG("Duplicate Acknowledgement: " << peers.send_windows[sender].base - 1 << ", "
+                                                        << packet.printable());
+                return;
+            }
+            metrics_add(COUNTER_ACKS_RECEIVED);
+            LOG_INFO(packet.printable());
+            LOG_INFO("Acknowledged message removed from store.");
         }
+        return; // Do not do forwarding step
     }
+    // Another copy of something already relayed (or sent from here) reached us by a different path
+    if (!state.seen.insert(SeenCache::make_key(!isMsg, packet.from_port, packet.to_port, packet.sequence_number,
+                                               packet.has_flag(PACKET_FLAG_REROUTED),
+                                               packet.has_flag(PACKET_FLAG_RETRANSMITTED)), EventLoop::now_ms())) {
+        metrics_add(COUNTER_SUPPRESSED);
+        LOG_DEBUG("Already relayed, dropping: " << packet.printable());
+        return;
+    }
+    int next_hop = route_to(state, peers.index_of(packet.to_port));
+    const std::vector<ushort> &path = packet.send_path;
+    if (next_hop != NO_PEER && std::find(path.begin(), path.end(), peers.ports[next_hop]) != path.end()) {
+        next_hop = NO_PEER; // The route leads back the way the packet came
+    }
+    forward_packet(peers, state.self, packet, next_hop);
+    if (next_hop != NO_PEER) metrics_add(COUNTER_ROUTED);
+    metrics_add(COUNTER_FORWARDED);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <Listen Port>" << std::endl;
-        return 1;
+// Runs one command from the operator or a script
+void run_command(DroneState &state, const Command &command) {
+    PeerTable &peers = state.peers;
+    if (command.kind == CommandKind::Stats) {
+        std::cout << metrics_report() << std::flush;
+        return;
     }
-    std::string config_file_path = "Samiul Alam-config.file";
-
+    if (command.kind == CommandKind::Invalid) {
+        std::cout << command.text << std::endl;
+        return;
+    }
+    int target = peers.index_of(command.port);
+    if (target == NO_PEER) {
+        std::cout << "Port not in config: " << command.port << std::endl;
+        return;
+    }
+    if (command.kind == CommandKind::Send) {
+        send_new_message(state, target, command.text);
+        return;
+    }
+    if (!state.grid.contains(command.location)) {
+        std::cout << "Location " << command.location << " is not on the grid" << std::endl;
+        return;
+    }
+    // Receivers ignore a move's sequence number, so one encoding (numbered as for the target)
+    // goes to every peer in a single batch
+    MoveCommand move_command(get_current_UTC_time(), command.port, state.listen_port, PROTOCOL_TTL,
+                             state.wire_version, 0, state.location(), peers.send_windows[target].next - 1,
+                             command.location);
+    const int self = state.self;
+    broadcast_packet(peers, move_command, [self](int peer) { return peer != self; });
+    LOG_INFO("Moving: " << move_command.printable());
+    state.move_peer(target, command.location);
+    print_config(peers, state.self);
+    resend_newly_reachable(state);
+}
 
-    int rows = ROWS, cols = COLS;
-    std::cout << "Grid is " << rows << " x " << cols << std::endl;
+void apply_timed(DroneState &state, DecodedDatagram &decoded) {
+    uint64_t started = metrics_now_ns();
+    apply_datagram(state, decoded);
+    metrics_record(HISTOGRAM_APPLY_NS, metrics_now_ns() - started);
+}
 
-    std::vector<ConfigEntry> config_entries;
-    ushort listen_port = static_cast<ushort>(std::stoi(argv[1]));
-    ushort send_to_port;
-    int location;
-    if (load_and_validate_config(config_file_path, config_entries, listen_port, send_to_port, location) != 0) return 1;
+int main(int argc, char *argv[]) {
+    DroneOptions options;
+    if (parse_options(argc, argv, options) != 0) return 1;
+    std::string config_file_path = options.config_file_path;
+
+    // SIGINT/SIGTERM arrive through a signalfd so the loop can stop and flush the log. Blocked
+    // before any thread starts, so every thread inherits the mask.
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+    int signal_file_descriptor = signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    set_log_level(options.log_level);
+    log_start();
+
+    RetransmitOptions retransmit_options = {
+            options.retransmit_timeout_ms,
+            options.retransmit_max_timeout_ms,
+            options.retransmit_jitter,
+            options.store_max_messages,
+            options.store_max_bytes
+    };
+    DroneState state(options, retransmit_options);
+    LOG_INFO("Grid is " << state.grid.rows() << " x " << state.grid.cols() << ", radio range "
+                        << state.grid.range());
+
+    PeerTable &peers = state.peers;
+    ushort listen_port = state.listen_port = options.listen_port;
+    if (load_and_validate_config(config_file_path, peers, listen_port, state.self) != 0) {
+        log_stop();
+        return 1;
+    }
+    state.held_messages.resize(static_cast<size_t>(peers.size()));
+    state.send_times.resize(static_cast<size_t>(peers.size()) * SLIDING_WINDOW_SIZE);
+    state.pending_acks.assign(static_cast<size_t>(peers.size()), DroneState::PendingAck());
+    state.routes.resize(static_cast<size_t>(peers.size()));
+    state.reachability.update(state.grid, peers.locations, state.self);
 
     int socket_file_descriptor = setup_listen_socket(listen_port);
-    fd_set read_file_descriptor;
-    int max_sd = socket_file_descriptor;
-
+    int send_file_descriptor = setup_send_socket();
 
-    std::string message_content;
-    auto listener_config = std::find_if(config_entries.begin(), config_entries.end(),
-                                        [listen_port](const ConfigEntry &e) {
-                                            return e.port == listen_port;
-                                        });
+    EventLoop loop;
 
-    struct timeval timeout{};
+    loop.watch(signal_file_descriptor, [&]() {
+        signalfd_siginfo info;
+        while (read(signal_file_descriptor, &info, sizeof(info)) > 0) {}
+        loop.stop();
+    });
 
-    while (true) {
-        FD_ZERO(&read_file_descriptor);
-        FD_SET(STDIN_FILENO, &read_file_descriptor);
-        FD_SET(socket_file_descriptor, &read_file_descriptor);
-        timeout.tv_sec = 20;
-        timeout.tv_usec = 0;
-        int rc = select(max_sd + 1, &read_file_descriptor, nullptr, nullptr, &timeout);
+    // Retransmission runs on its own timer, so steady traffic can no longer starve it; each
+    // message still waits for its own backoff deadline
+    loop.schedule_every(RETRANSMIT_CHECK_MS, [&]() {
+        if (!state.retransmit_store.empty()) resend_messages(state);
+    });
 
-        if (rc < 0) {
-            std::cerr << "Select error." << std::endl;
-            break; // Exit the loop in case of select error
-        }
-
-        if (rc == 0 && !message_store.empty()) {
-            resend_messages(config_entries);
-            std::cout << "Timeout! Resending messages.\n";
-            continue;
-        }
+    if (state.ack_delay_ms > 0) {
+        loop.schedule_every(EVENT_LOOP_TICK_MS, [&]() { send_due_acknowledgements(state, EventLoop::now_ms()); });
+    }
 
-        if (FD_ISSET(socket_file_descriptor, &read_file_descriptor)) {
-            char buffer[BUFFER_SIZE];
-            sockaddr_in client_address{};
-            socklen_t len = sizeof(client_address);
-
-
-            long n = recvfrom(socket_file_descriptor, buffer, BUFFER_SIZE, 0,
-                              reinterpret_cast<struct sockaddr *>(&client_address), &len);
-            if (n > 0) {
-                buffer[n] = '\0'; // Null-terminate the received data
-                std::string received_message(buffer);
-                // Got a message
-                std::pair<std::unique_ptr<Packet>, bool> result;
-                std::unordered_map<std::basic_string<char>, std::basic_string<char>> map;
-                try {
-                    map = parse_message(received_message);
-
-                } catch (const std::exception &e) {
-                    std::cout << "Parsing Error" << std::endl;
-                    continue;
-                }
-                if (map.find("move") != map.end()) {
-                    if (listen_port == std::stoi(map["to_port"])) {
-                        location = std::stoi(map["move"]);
-                    }
-                    for (auto &entry: config_entries) {
-                        if (entry.port == std::stoi(map["to_port"])) {
-                            entry.location = std::stoi(map["move"]);
-                        }
+    if (!options.stats_file_path.empty()) {
+        loop.schedule_every(options.stats_interval_ms, [&]() {
+            if (!metrics_write_snapshot(options.stats_file_path)) {
+                LOG_WARN("Could not write stats file " << options.stats_file_path);
+            }
+        });
+    }
 
+    std::unique_ptr<Pipeline> pipeline;
+    ReceiveBatch receive_batch(options.workers > 0 ? 0 : RECEIVE_BATCH_CAPACITY, BUFFER_SIZE);
+    DecodedDatagram decoded;
+    auto decode_and_apply = [&](const char *data, size_t length) {
+        uint64_t started = metrics_now_ns();
+        decode_datagram(data, length, decoded);
+        metrics_record(HISTOGRAM_DECODE_NS, metrics_now_ns() - started);
+        apply_timed(state, decoded);
+    };
+    if (options.workers > 0) {
+        // Receiving, decoding and sending move to their own threads; this thread keeps the
+        // drone state and applies decoded datagrams as the workers hand them over
+        pipeline.reset(new Pipeline(socket_file_descriptor, send_file_descriptor, options.workers, BUFFER_SIZE));
+        Pipeline &stages = *pipeline;
+        set_send_offload([&stages](OutgoingDatagrams &datagrams) { return stages.offload(datagrams); });
+        loop.watch(stages.wake_descriptor(), [&]() {
+            stages.drain([&](DecodedDatagram &datagram) { apply_timed(state, datagram); });
+        });
+    } else {
+        loop.watch(socket_file_descriptor, [&]() {
+            int received;
+            do {
+                received = receive_batch.receive(socket_file_descriptor);
+                if (received > 0) metrics_add(COUNTER_RECEIVED, static_cast<uint64_t>(received));
+                for (int i = 0; i < received; ++i) {
+                    const ReceivedDatagram datagram = receive_batch.datagram(static_cast<size_t>(i));
+                    if (datagram.truncated) {
+                        metrics_add(COUNTER_OVERSIZED);
+                        LOG_WARN("Dropping oversized datagram (" << datagram.length << " bytes)");
+                        continue;
                     }
-                    std::cout << "Moving: " << received_message << std::endl;
-                    print_config(config_entries, listen_port);
-                    resend_messages(config_entries);
-                    continue;
-                }
-                result = process_incoming_message(map);
-                Packet &packet = *result.first;
-                bool isMsg = result.second;
-                if (result.first == nullptr) continue; // Check if message is valid
-                bool is_duplicate = false;
-                int forward_distance = find_distance(rows, cols, location, packet);
-                if (forward_distance > 2 || packet.ttl < 0) continue; // Check if message is within range and ttl
-
-                if (listener_config->port == packet.to_port) {
-                    // Check if message meant for current location
-                    if (isMsg) {
-                        // Check if it is a duplicate message
-                        auto p = packet.from_port;
-                        auto sender_config = std::find_if(config_entries.begin(), config_entries.end(),
-                                                          [p](const ConfigEntry &e) {
-                                                              return e.port == p;
-                                                          });
-                        is_duplicate = packet.sequence_number <= sender_config->send_sequence;
-                        if (is_duplicate)
-                            std::cout << "Duplicate Message: " << sender_config->send_sequence << ", "
-                                      << packet.serialize()
-                                      << std::endl;
-                        else sender_config->send_sequence = packet.sequence_number;
-                    } else {
-                        // Check if it is a duplicate acknowledgement
-                        auto p = packet.from_port;
-                        auto sender_config = std::find_if(config_entries.begin(), config_entries.end(),
-                                                          [p](const ConfigEntry &e) {
-                                                              return e.port == p;
-                                                          });
-                        is_duplicate = packet.sequence_number <= sender_config->receive_sequence;
-                        if (is_duplicate)
-                            std::cout << "Duplicate Acknowledgement: " << sender_config->receive_sequence << ", "
-                                      << packet.serialize() << std::endl;
-                        else sender_config->receive_sequence = packet.sequence_number;
+                    if (!is_envelope(datagram.data, datagram.length)) {
+                        decode_and_apply(datagram.data, datagram.length);
+                        continue;
                     }
-                }
-                if (is_duplicate) continue; // If duplicate then continue
-                if (listen_port == packet.to_port) {
-                    // Is message/ack meant for current drone
-                    std::cout << packet.serialize() << std::endl;
-                    if (isMsg) { // If it is a message
-                        listener_config->receive_sequence = packet.sequence_number;
-                        for (const auto &entry: config_entries) {
-                            if (entry.port != listen_port) {
-                                auto ack = Acknowledgement(
-                                        get_current_UTC_time(),
-                                        "ACK",
-                                        packet.from_port,
-                                        packet.to_port,
-                                        PROTOCOL_TTL,
-                                        PROTOCOL_VERSION, 0, location,
-                                        listener_config->receive_sequence, std::vector<ushort>{listen_port});
-                                int backward_distance = find_distance(rows, cols, entry.location, ack);
-                                if (backward_distance <= 2) { // Send ACK if within range
-                                    send_message_to_entry(entry, ack);
-                                }
-                            }
-                        }
-                    } else {
-                        remove_message_if_acked(packet);
-                        std::cout << "Acknowledged message removed from store." << std::endl;
+                    EnvelopeReader reader(datagram.data, datagram.length);
+                    const char *packet;
+                    size_t length;
+                    while (reader.next(packet, length)) decode_and_apply(packet, length);
+                    if (reader.malformed()) {
+                        metrics_add(COUNTER_PARSE_ERRORS);
+                        LOG_WARN("Malformed envelope (" << datagram.length << " bytes)");
                     }
-                    continue; // Do not do forwarding step
                 }
-                forward_packet(config_entries, listen_port, location, packet);
-            }
+            } while (received == static_cast<int>(receive_batch.capacity())); // More may be queued
+        });
+    }
+
+    // Coalescing sits in front of the send thread when there is one
+    std::unique_ptr<Coalescer> coalescer;
+    if (options.coalesce_ms > 0) {
+        SendOffload downstream;
+        if (pipeline) {
+            Pipeline &stages = *pipeline;
+            downstream = [&stages](OutgoingDatagrams &datagrams) { return stages.offload(datagrams); };
         }
-        if (FD_ISSET(STDIN_FILENO, &read_file_descriptor)) {
-            while (true) {
-                std::cout << "Enter the port number to send to: ";
-                std::cin >> send_to_port;
-                auto send_to_config = std::find_if(config_entries.begin(), config_entries.end(),
-                                                   [send_to_port](const ConfigEntry &e) {
-                                                       return e.port == send_to_port;
-                                                   });
-                if (send_to_config != config_entries.end()) {
-                    break;
-                }
-                std::cout << "Port not in config" << std::endl;
-            }
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear the input buffer
-
-            std::cout << "Enter message: ";
-            std::getline(std::cin, message_content); // Read the entire message
-            if (message_content.empty()) {
-                std::cout << "Moving drone..." << std::endl;
-                std::cout << "Enter New Location:" << std::endl;
-                int new_location;
-                std::cin >> new_location;
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear the input buffer
-
-                for (auto &entry: config_entries) {
-                    if (entry.port == send_to_port) {
-                        entry.send_sequence += 1;
-                    }
-                    auto move_command = MoveCommand(get_current_UTC_time(), send_to_port, listen_port, PROTOCOL_TTL,
-                                                    PROTOCOL_VERSION,
-                                                    0, location, entry.send_sequence, new_location);
-                    if (entry.port != listen_port) {
-                        send_message_to_entry(entry, move_command);
-                    }
+        coalescer.reset(new Coalescer(send_file_descriptor, options.coalesce_bytes, downstream));
+        Coalescer &packer = *coalescer;
+        set_send_offload([&packer](OutgoingDatagrams &datagrams) { return packer.add(datagrams); });
+        loop.schedule_every(options.coalesce_ms, [&packer]() { packer.flush(); });
+    }
 
-                    if (entry.port == send_to_port) {
-                        entry.location = new_location;
-                        std::cout << "Moving: " << move_command.serialize() << std::endl;
-                    }
-                }
-                print_config(config_entries, listen_port);
+    // stdin and the script are polled once a tick rather than watched, so a flood of input is
+    // read no faster than it runs and a regular file (which epoll refuses) works the same way
+    std::vector<std::unique_ptr<CommandChannel>> channels;
+    bool interactive = isatty(STDIN_FILENO);
+    if (interactive) {
+        std::cout << "Commands: send <port> <message> | move <port> <location> | stats | wait <ms>" << std::endl;
+    }
+    channels.emplace_back(new CommandChannel(STDIN_FILENO, options.command_rate, interactive, EventLoop::now_ms()));
+    if (!options.script_path.empty()) {
+        int script_file_descriptor = open(options.script_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (script_file_descriptor < 0) {
+            LOG_ERROR("Could not open script " << options.script_path << ": " << strerror(errno));
+        } else {
+            channels.emplace_back(new CommandChannel(script_file_descriptor, options.command_rate, false,
+                                                     EventLoop::now_ms()));
+        }
+    }
+    loop.schedule_every(EVENT_LOOP_TICK_MS, [&]() {
+        for (auto it = channels.begin(); it != channels.end();) {
+            CommandChannel &channel = **it;
+            while (!channel.full() && channel.fill() > 0) {}
+            Command command;
+            while (channel.next(command, EventLoop::now_ms())) run_command(state, command);
+            if (!channel.finished()) {
+                ++it;
                 continue;
             }
-            listener_config->send_sequence += 1;
-            for (const auto &entry: config_entries) {
-                if (entry.port != listen_port) {
-                    Message message = Message(get_current_UTC_time(), message_content, send_to_port, listen_port,
-                                              PROTOCOL_TTL,
-                                              PROTOCOL_VERSION, 0, location, listener_config->send_sequence,
-                                              std::vector<ushort>{listen_port});
-                    send_message_to_entry(entry, message);
-                    message_store.push_back(message);
-
-                }
+            // Keep relaying once the input is used up
+            if (channel.descriptor() != STDIN_FILENO) {
+                LOG_INFO("Script " << options.script_path << " finished");
+                close(channel.descriptor());
             }
+            it = channels.erase(it);
         }
-    }
+    });
+
+    int rc = loop.run();
+
+    if (coalescer) coalescer->flush();
+    set_send_offload(SendOffload());
+    pipeline.reset(); // Joins the pipeline threads before the sockets close
+    if (!options.stats_file_path.empty()) metrics_write_snapshot(options.stats_file_path);
+    log_stop();
+    close(signal_file_descriptor);
 
     close(socket_file_descriptor); // Cleanup
-    return 0;
+    close_send_socket();
+    return rc == 0 ? 0 : 1;
 }
@@ -0,0 +1,320 @@
+// Micro-benchmarks for the packet hot paths: parsing, encoding, decoding, range checks and
+// forwarding, each run over the same corpus of short ACKs, short and long messages and long send
+// paths in both wire encodings. Reports ns/op, heap allocations/op and throughput; --json prints
+// the same numbers as one JSON array for comparing builds.
+#include "Grid.h"
+#include "Message.h"
+#include "PeerTable.h"
+#include "Utility.h"
+#include "WireParser.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BENCH_PROTOCOL_VERSION 8
+#define BENCH_PEERS 64
+#define BENCH_FIRST_PORT 20000
+#define BENCH_DEFAULT_MIN_TIME_MS 200
+
+// Every heap allocation in the process goes through here, so a benchmark's allocations are the
+// difference in this count across its run. The benchmarks are single threaded.
+static uint64_t allocation_count = 0;
+
+void *operator new(size_t size) {
+    ++allocation_count;
+    void *memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+// Keeps results alive so the optimizer cannot drop the work that produced them
+static volatile size_t sink;
+
+struct Corpus {
+    const char *name;
+    bool acknowledgement;
+    size_t msg_length;
+    size_t path_length;
+};
+
+static const Corpus corpora[] = {
+        {"ack",       true,  0,   2},
+        {"short_msg", false, 24,  2},
+        {"long_msg",  false, 800, 2},
+        {"long_path", false, 24,  40}
+};
+
+struct Benchmark {
+    std::string name;
+    size_t bytes_per_op; // 0 when throughput in bytes means nothing for it
+    std::function<void()> op;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocations_per_op;
+    double ops_per_second;
+    double megabytes_per_second;
+};
+
+static std::vector<ushort> make_path(size_t length) {
+    std::vector<ushort> path;
+    for (size_t i = 0; i < length; ++i) path.push_back(static_cast<ushort>(BENCH_FIRST_PORT + i));
+    return path;
+}
+
+static std::unique_ptr<Packet> make_packet(const Corpus &corpus, short version) {
+    std::vector<ushort> path = make_path(corpus.path_length);
+    ushort to_port = BENCH_FIRST_PORT + BENCH_PEERS - 1;
+    if (corpus.acknowledgement) {
+        Acknowledgement *ack = new Acknowledgement(1700000000, "ACK", BENCH_FIRST_PORT, to_port, 5, version, 0, 7,
+                                                   1234, path);
+        ack->cumulative_ack = 1230;
+        ack->sack = 0x5;
+        return std::unique_ptr<Packet>(ack);
+    }
+    std::string text;
+    for (size_t i = 0; i < corpus.msg_length; ++i) text.push_back(static_cast<char>('a' + i % 26));
+    return std::unique_ptr<Packet>(new Message(1700000000, text, to_port, BENCH_FIRST_PORT, 5, version, 0, 7, 1234,
+                                               path));
+}
+
+// Loopback socket the forward benchmarks send to; nothing reads it, so the kernel drops the
+// overflow, which is what a slow peer looks like anyway
+static int open_sink(sockaddr_in &address) {
+    int file_descriptor = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (file_descriptor < 0 || bind(file_descriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        getsockname(file_descriptor, reinterpret_cast<sockaddr *>(&address), &length) < 0) {
+        std::cerr << "Could not open a loopback socket" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return file_descriptor;
+}
+
+// BENCH_PEERS drones whose ports are the ones used in the corpus send paths, all addressed to
+// the sink
+static PeerTable make_peers(const sockaddr_in &sink_address) {
+    std::vector<ConfigEntry> entries;
+    for (int i = 0; i < BENCH_PEERS; ++i) {
+        ConfigEntry entry("127.0.0.1", static_cast<ushort>(BENCH_FIRST_PORT + i), i + 1);
+        entry.address = sink_address;
+        entries.push_back(entry);
+    }
+    return PeerTable(entries);
+}
+
+// Everything a benchmark needs that must outlive the closures
+struct Fixture {
+    std::string wire;
+    WireFields fields;
+    std::unique_ptr<Packet> packet;
+    DecodedDatagram datagram;
+};
+
+static void add_corpus_benchmarks(std::vector<Benchmark> &benchmarks, std::vector<std::unique_ptr<Fixture>> &fixtures,
+                                  PeerTable &peers, const Corpus &corpus, bool binary) {
+    fixtures.emplace_back(new Fixture());
+    Fixture &fixture = *fixtures.back();
+    fixture.packet = make_packet(corpus, binary ? WIRE_BINARY_VERSION : BENCH_PROTOCOL_VERSION);
+    fixture.wire = fixture.packet->encoded();
+    if (!parse_wire(fixture.wire, fixture.fields)) {
+        std::cerr << "Corpus " << corpus.name << " does not parse" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    PacketKind kind = classify_packet(fixture.fields);
+    std::string suffix = std::string("/") + corpus.name + (binary ? "/binary" : "/text");
+    size_t bytes = fixture.wire.size();
+
+    benchmarks.push_back({"parse_wire" + suffix, bytes, [&fixture]() {
+        WireFields fields;
+        sink += parse_wire(fixture.wire.data(), fixture.wire.size(), fields);
+    }});
+    benchmarks.push_back({"encode" + suffix, bytes, [&fixture]() {
+        // A full encode, as when a drone originates a packet; relays patch instead (see forward)
+        fixture.packet->invalidate_encoding();
+        sink += fixture.packet->encoded().size();
+    }});
+    if (!binary) {
+        benchmarks.push_back({"serialize" + suffix, bytes, [&fixture]() {
+            sink += fixture.packet->serialize().size();
+        }});
+    }
+    if (!corpus.acknowledgement) {
+        benchmarks.push_back({"Message::deserialize" + suffix, bytes, [&fixture]() {
+            sink += Message::deserialize(fixture.fields).msg.size();
+        }});
+    }
+    benchmarks.push_back({"process_incoming_message" + suffix, bytes, [&fixture, kind]() {
+        sink += static_cast<size_t>(process_incoming_message(fixture.fields, kind, fixture.datagram));
+    }});
+    benchmarks.push_back({"decode_datagram" + suffix, bytes, [&fixture]() {
+        decode_datagram(fixture.wire.data(), fixture.wire.size(), fixture.datagram);
+        sink += fixture.datagram.parsed;
+    }});
+    if (corpus.acknowledgement) return;
+
+    // Relay one received copy: the packet is reset to its decoded state before every call, which
+    // is a copy into buffers that already have the capacity
+    int self = static_cast<int>(corpus.path_length);
+    fixtures.emplace_back(new Fixture());
+    Fixture &relay = *fixtures.back();
+    relay.wire = fixture.wire;
+    parse_wire(relay.wire, relay.fields);
+    process_incoming_message(relay.fields, kind, relay.datagram);
+    benchmarks.push_back({"forward_packet" + suffix, bytes, [&relay, &peers, self]() {
+        Packet &packet = *relay.datagram.packet;
+        packet.ttl = relay.fields.ttl;
+        packet.location = relay.fields.location;
+        packet.send_path.resize(relay.fields.send_path_length);
+        packet.adopt_encoding(relay.fields);
+        sink += forward_packet(peers, self, packet);
+    }});
+
+    // What a drone does per datagram in steady state, from the receive buffer to the sends;
+    // both should report 0 allocs/op
+    benchmarks.push_back({"relay_cycle" + suffix, bytes, [&relay, &peers, self]() {
+        decode_datagram(relay.wire.data(), relay.wire.size(), relay.datagram);
+        sink += forward_packet(peers, self, *relay.datagram.packet);
+    }});
+    relay.packet.reset(new Acknowledgement(0, "ACK", 0, 0, 0, 0, 0, 0, 0, std::vector<ushort>()));
+    benchmarks.push_back({"ack_reply" + suffix, bytes, [&relay, &peers, self]() {
+        decode_datagram(relay.wire.data(), relay.wire.size(), relay.datagram);
+        const Packet &message = *relay.datagram.packet;
+        Packet &ack = *relay.packet;
+        ack.reset(0, message.from_port, message.to_port, message.ttl,
+                  message.binary() ? WIRE_BINARY_VERSION : BENCH_PROTOCOL_VERSION, 0, message.location,
+                  message.sequence_number);
+        ack.send_path.assign(1, message.to_port);
+        sink += broadcast_packet(peers, ack, [self](int peer) { return peer != self; });
+    }});
+}
+
+static void add_grid_benchmark(std::vector<Benchmark> &benchmarks, Grid &grid, std::vector<int> &pairs) {
+    // Random location pairs, so the range table is read the way a busy swarm reads it
+    std::minstd_rand random(42);
+    int cells = grid.rows() * grid.cols();
+    for (int i = 0; i < 2048; ++i) pairs.push_back(static_cast<int>(random() % static_cast<unsigned>(cells)) + 1);
+    size_t next = 0;
+    benchmarks.push_back({"grid_in_range/64x64/range8", 0, [&grid, &pairs, next]() mutable {
+        sink += grid.in_range(pairs[next], pairs[next + 1]);
+        next = (next + 2) % pairs.size();
+    }});
+}
+
+static Result run(const Benchmark &benchmark, uint64_t min_time_ns) {
+    typedef std::chrono::steady_clock Clock;
+    benchmark.op(); // Warm caches and let buffers reach their working size
+    uint64_t iterations = 1;
+    while (true) {
+        uint64_t allocations_before = allocation_count;
+        Clock::time_point started = Clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) benchmark.op();
+        uint64_t elapsed = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count());
+        uint64_t allocations = allocation_count - allocations_before;
+        if (elapsed >= min_time_ns || iterations >= (static_cast<uint64_t>(1) << 40)) {
+            Result result;
+            result.name = benchmark.name;
+            result.iterations = iterations;
+            result.ns_per_op = static_cast<double>(elapsed) / static_cast<double>(iterations);
+            result.allocations_per_op = static_cast<double>(allocations) / static_cast<double>(iterations);
+            result.ops_per_second = result.ns_per_op > 0 ? 1e9 / result.ns_per_op : 0;
+            result.megabytes_per_second = static_cast<double>(benchmark.bytes_per_op) * result.ops_per_second / 1e6;
+            return result;
+        }
+        // Aim a little past the target from what this round took
+        uint64_t scaled = elapsed == 0 ? iterations * 100 : iterations * min_time_ns / elapsed * 6 / 5;
+        iterations = std::max(iterations * 2, std::min(scaled, iterations * 100));
+    }
+}
+
+static void print_usage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --json                 print results as a JSON array\n"
+              << "  --filter <text>        only run benchmarks whose name contains text\n"
+              << "  --min-time-ms <ms>     measuring time per benchmark (default: " << BENCH_DEFAULT_MIN_TIME_MS
+              << ")" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    std::string filter;
+    uint64_t min_time_ms = BENCH_DEFAULT_MIN_TIME_MS;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc) {
+            min_time_ms = strtoull(argv[++i], nullptr, 10);
+            if (min_time_ms == 0) min_time_ms = 1;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    sockaddr_in sink_address;
+    int sink_file_descriptor = open_sink(sink_address);
+    PeerTable peers = make_peers(sink_address);
+    Grid grid(64, 64, 8);
+    std::vector<int> pairs;
+
+    std::vector<Benchmark> benchmarks;
+    std::vector<std::unique_ptr<Fixture>> fixtures;
+    for (const Corpus &corpus: corpora) {
+        add_corpus_benchmarks(benchmarks, fixtures, peers, corpus, false);
+        add_corpus_benchmarks(benchmarks, fixtures, peers, corpus, true);
+    }
+    add_grid_benchmark(benchmarks, grid, pairs);
+
+    std::vector<Result> results;
+    if (!json) printf("%-44s %12s %12s %10s %14s %10s\n", "benchmark", "iterations", "ns/op", "allocs/op", "ops/s", "MB/s");
+    for (const Benchmark &benchmark: benchmarks) {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) continue;
+        Result result = run(benchmark, min_time_ms * 1000000);
+        if (!json) {
+            printf("%-44s %12llu %12.1f %10.2f %14.0f %10.1f\n", result.name.c_str(),
+                   static_cast<unsigned long long>(result.iterations), result.ns_per_op, result.allocations_per_op,
+                   result.ops_per_second, result.megabytes_per_second);
+            fflush(stdout);
+        }
+        results.push_back(result);
+    }
+    if (json) {
+        printf("[\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result &result = results[i];
+            printf("  {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, "
+                   "\"ops_per_sec\": %.0f, \"mb_per_sec\": %.2f}%s\n", result.name.c_str(),
+                   static_cast<unsigned long long>(result.iterations), result.ns_per_op, result.allocations_per_op,
+                   result.ops_per_second, result.megabytes_per_second, i + 1 < results.size() ? "," : "");
+        }
+        printf("]\n");
+    }
+    close(sink_file_descriptor);
+    close_send_socket();
+    return 0;
+}
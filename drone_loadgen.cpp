@@ -0,0 +1,440 @@
+// Load generator for end-to-end tests against running drone3 processes. It joins the swarm as
+// the drone listed at its own port in the config, originates Message traffic at a fixed rate to
+// one or more target drones and collects their ACKs itself, then reports delivered throughput,
+// loss and ACK round-trip percentiles. Outgoing datagrams can be dropped, duplicated or
+// reordered on purpose to see how the swarm copes.
+#include "BinaryWire.h"
+#include "EventLoop.h"
+#include "Message.h"
+#include "Metrics.h"
+#include "PeerTable.h"
+#include "Transport.h"
+#include "Utility.h"
+#include "WireParser.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#define LOADGEN_PROTOCOL_VERSION 8
+#define LOADGEN_TTL 5
+#define LOADGEN_BUFFER_SIZE 1024
+
+struct LoadOptions {
+    ushort listen_port = 0;
+    std::string config_file_path = "Samiul Alam-config.file";
+    std::vector<ushort> targets;
+    uint64_t rate = 100;          // Messages per second, over all targets
+    uint64_t duration_s = 10;
+    uint64_t drain_ms = 2000;     // How long to keep collecting ACKs after the last send
+    uint64_t first_sequence = 1;
+    size_t min_size = 32;
+    size_t max_size = 32;
+    bool binary_wire = false;
+    double loss = 0;
+    double duplicate = 0;
+    double reorder = 0;
+    bool json = false;
+};
+
+// Messages to one target drone. Drones remember the sequences they have seen from this port, so a
+// rerun against the same drones should start past the previous run's numbers.
+struct Target {
+    int peer;
+    int next_sequence;
+    std::map<int, uint64_t> in_flight; // Sequence -> first send, in ns
+    uint64_t sent;
+    uint64_t acknowledged;
+};
+
+// A datagram held back so that the one after it overtakes it
+struct Deferred {
+    sockaddr_in address;
+    std::string payload;
+};
+
+static void print_usage(const char *program) {
+    std::cerr << "Usage: " << program << " <Listen Port> --to <port>[,<port>...] [options]\n"
+              << "  --config <file>          peer list, same format as drone3 (default: Samiul Alam-config.file)\n"
+              << "  --to <ports>             drones to send messages to, round robin\n"
+              << "  --rate <n>               messages per second over all targets (default: 100)\n"
+              << "  --duration-s <n>         how long to send (default: 10)\n"
+              << "  --drain-ms <ms>          how long to wait for ACKs afterwards (default: 2000)\n"
+              << "  --first-sequence <n>     sequence number of the first message to each target (default: 1)\n"
+              << "  --size <n>[-<m>]         message text length, or a uniform range (default: 32)\n"
+              << "  --wire <text|binary>     encoding of the messages (default: text)\n"
+              << "  --loss <fraction>        drop this share of outgoing datagrams\n"
+              << "  --duplicate <fraction>   send this share of outgoing datagrams twice\n"
+              << "  --reorder <fraction>     hold this share back behind the next datagram\n"
+              << "  --json                   print the report as one JSON object" << std::endl;
+}
+
+static bool parse_number(const char *text, uint64_t min, uint64_t max, uint64_t &out) {
+    if (*text == '\0' || *text == '-') return false;
+    char *end;
+    errno = 0;
+    unsigned long long value = std::strtoull(text, &end, 10);
+    if (errno != 0 || *end != '\0' || value < min || value > max) return false;
+    out = value;
+    return true;
+}
+
+static bool parse_probability(const char *text, double &out) {
+    char *end;
+    errno = 0;
+    double value = std::strtod(text, &end);
+    if (errno != 0 || *end != '\0' || end == text || value < 0.0 || value > 1.0) return false;
+    out = value;
+    return true;
+}
+
+static bool parse_targets(const char *text, std::vector<ushort> &targets) {
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        uint64_t port;
+        if (!parse_number(list.substr(start, comma - start).c_str(), 1, 65535, port)) return false;
+        targets.push_back(static_cast<ushort>(port));
+        start = comma + 1;
+    }
+    return !targets.empty();
+}
+
+static bool parse_size(const char *text, size_t &min_size, size_t &max_size) {
+    std::string range(text);
+    size_t dash = range.find('-');
+    uint64_t low, high;
+    if (!parse_number(range.substr(0, dash).c_str(), 1, LOADGEN_BUFFER_SIZE, low)) return false;
+    high = low;
+    if (dash != std::string::npos &&
+        !parse_number(range.substr(dash + 1).c_str(), low, LOADGEN_BUFFER_SIZE, high)) {
+        return false;
+    }
+    min_size = static_cast<size_t>(low);
+    max_size = static_cast<size_t>(high);
+    return true;
+}
+
+static int parse_load_options(int argc, char *argv[], LoadOptions &options) {
+    uint64_t number;
+    if (argc < 2 || !parse_number(argv[1], 1, 65535, number)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    options.listen_port = static_cast<ushort>(number);
+    for (int i = 2; i < argc; ++i) {
+        const char *name = argv[i];
+        if (std::strcmp(name, "--json") == 0) {
+            options.json = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << name << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        bool ok = true;
+        if (std::strcmp(name, "--config") == 0) {
+            options.config_file_path = value;
+        } else if (std::strcmp(name, "--to") == 0) {
+            ok = parse_targets(value, options.targets);
+        } else if (std::strcmp(name, "--rate") == 0) {
+            ok = parse_number(value, 1, 10000000, options.rate);
+        } else if (std::strcmp(name, "--duration-s") == 0) {
+            ok = parse_number(value, 1, 86400, options.duration_s);
+        } else if (std::strcmp(name, "--drain-ms") == 0) {
+            ok = parse_number(value, 0, 3600000, options.drain_ms);
+        } else if (std::strcmp(name, "--first-sequence") == 0) {
+            ok = parse_number(value, 1, 0x3fffffff, options.first_sequence);
+        } else if (std::strcmp(name, "--size") == 0) {
+            ok = parse_size(value, options.min_size, options.max_size);
+        } else if (std::strcmp(name, "--wire") == 0) {
+            ok = std::strcmp(value, "text") == 0 || std::strcmp(value, "binary") == 0;
+            options.binary_wire = std::strcmp(value, "binary") == 0;
+        } else if (std::strcmp(name, "--loss") == 0) {
+            ok = parse_probability(value, options.loss);
+        } else if (std::strcmp(name, "--duplicate") == 0) {
+            ok = parse_probability(value, options.duplicate);
+        } else if (std::strcmp(name, "--reorder") == 0) {
+            ok = parse_probability(value, options.reorder);
+        } else {
+            std::cerr << "Unknown option: " << name << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (!ok) {
+            std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.targets.empty()) {
+        std::cerr << "No target drones given (--to)" << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+class LoadGenerator {
+public:
+    LoadGenerator(const LoadOptions &options, PeerTable &peers, int self)
+            : options(options), peers(peers), self(self), random(std::random_device()()), next_target(0),
+              started_ns(0), sent_datagrams(0), dropped(0), duplicated(0), reordered(0), received(0),
+              duplicate_acks(0), stray(0) {
+        for (ushort port: options.targets) {
+            Target target = {peers.index_of(port), static_cast<int>(options.first_sequence),
+                             std::map<int, uint64_t>(), 0, 0};
+            targets.push_back(target);
+        }
+    }
+
+    bool valid_targets() const {
+        for (size_t i = 0; i < targets.size(); ++i) {
+            if (targets[i].peer == NO_PEER || targets[i].peer == self) {
+                std::cerr << "Target " << options.targets[i] << " is not another drone in the config" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void start() { started_ns = metrics_now_ns(); }
+
+    // Sends whatever the rate says is due by now, in one batch, after anything held back last time
+    void send_due(bool sending) {
+        uint64_t due = 0;
+        uint64_t sent = sent_messages();
+        if (sending) due = options.rate * (metrics_now_ns() - started_ns) / 1000000000;
+        if (due <= sent && deferred_datagrams.empty()) return;
+
+        SendBatch batch(setup_send_socket());
+        std::deque<Deferred> held; // Reordered datagrams from this round; they go out next round
+        std::deque<std::string> payloads; // Must outlive the batch's references
+        for (Deferred &deferred: deferred_datagrams) batch.add(deferred.address, deferred.payload.data(),
+                                                                deferred.payload.size());
+        for (; sent < due; ++sent) {
+            Target &target = targets[next_target];
+            next_target = (next_target + 1) % targets.size();
+            payloads.push_back(encode_next(target));
+            const std::string &payload = payloads.back();
+            for (int peer = 0; peer < peers.size(); ++peer) {
+                if (peer == self) continue;
+                queue_impaired(batch, held, peers.addresses[peer], payload);
+            }
+        }
+        batch.flush();
+        deferred_datagrams.swap(held);
+    }
+
+    void receive(const char *data, size_t length) {
+        ++received;
+        WireFields fields;
+        if (!parse_wire(data, length, fields) || classify_packet(fields) != PacketKind::Acknowledgement ||
+            fields.to_port != peers.ports[self]) {
+            ++stray;
+            return;
+        }
+        Target *target = nullptr;
+        for (Target &candidate: targets) {
+            if (peers.ports[candidate.peer] == fields.from_port) target = &candidate;
+        }
+        if (target == nullptr) {
+            ++stray;
+            return;
+        }
+        uint64_t now = metrics_now_ns();
+        size_t settled = settle(*target, fields.sequence_number, now);
+        if (fields.has(KEY_CUMULATIVE_ACK)) {
+            while (!target->in_flight.empty() && target->in_flight.begin()->first <= fields.cumulative_ack) {
+                settled += settle(*target, target->in_flight.begin()->first, now);
+            }
+            for (int bit = 0; bit < 64; ++bit) {
+                if ((fields.sack >> bit) & 1) settled += settle(*target, fields.cumulative_ack + 1 + bit, now);
+            }
+        }
+        if (settled == 0) ++duplicate_acks;
+    }
+
+    void report(uint64_t send_ns, uint64_t total_ns) const {
+        uint64_t sent = 0, acknowledged = 0;
+        for (const Target &target: targets) {
+            sent += target.sent;
+            acknowledged += target.acknowledged;
+        }
+        double send_s = static_cast<double>(send_ns) / 1e9;
+        double offered = send_s > 0 ? static_cast<double>(sent) / send_s : 0;
+        double delivered = send_s > 0 ? static_cast<double>(acknowledged) / send_s : 0;
+        double loss = sent > 0 ? 1.0 - static_cast<double>(acknowledged) / static_cast<double>(sent) : 0;
+        HistogramSummary rtt = round_trip.summarize();
+        if (options.json) {
+            printf("{\"sent\": %llu, \"acknowledged\": %llu, \"loss\": %.4f, \"offered_per_sec\": %.1f, "
+                   "\"delivered_per_sec\": %.1f, \"datagrams_sent\": %llu, \"injected_loss\": %llu, "
+                   "\"injected_duplicates\": %llu, \"injected_reorders\": %llu, \"datagrams_received\": %llu, "
+                   "\"duplicate_acks\": %llu, \"stray\": %llu, \"elapsed_ms\": %llu, \"rtt_us\": {\"count\": %llu, "
+                   "\"mean\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}\n",
+                   ull(sent), ull(acknowledged), loss, offered, delivered, ull(sent_datagrams), ull(dropped),
+                   ull(duplicated), ull(reordered), ull(received), ull(duplicate_acks), ull(stray),
+                   ull(total_ns / 1000000), ull(rtt.count), ull(rtt.mean), ull(rtt.p50), ull(rtt.p90),
+                   ull(rtt.p99), ull(rtt.p999), ull(rtt.max));
+            return;
+        }
+        printf("messages sent        %llu (%.1f/s offered)\n", ull(sent), offered);
+        printf("messages acked       %llu (%.1f/s delivered)\n", ull(acknowledged), delivered);
+        printf("loss                 %.2f%%\n", loss * 100);
+        printf("datagrams sent       %llu (injected: %llu lost, %llu duplicated, %llu reordered)\n",
+               ull(sent_datagrams), ull(dropped), ull(duplicated), ull(reordered));
+        printf("datagrams received   %llu (%llu duplicate ACKs, %llu not ACKs for us)\n", ull(received),
+               ull(duplicate_acks), ull(stray));
+        printf("ack round trip (us)  mean %llu  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+               ull(rtt.mean), ull(rtt.p50), ull(rtt.p90), ull(rtt.p99), ull(rtt.p999), ull(rtt.max));
+        for (const Target &target: targets) {
+            printf("  to %-6u sent %llu  acked %llu\n", peers.ports[target.peer], ull(target.sent),
+                   ull(target.acknowledged));
+        }
+    }
+
+private:
+    const LoadOptions &options;
+    PeerTable &peers;
+    int self;
+    std::minstd_rand random;
+    std::vector<Target> targets;
+    size_t next_target;
+    uint64_t started_ns;
+    std::deque<Deferred> deferred_datagrams;
+    Histogram round_trip;
+    uint64_t sent_datagrams, dropped, duplicated, reordered;
+    uint64_t received, duplicate_acks, stray;
+
+    static unsigned long long ull(uint64_t value) { return static_cast<unsigned long long>(value); }
+
+    double chance() { return std::uniform_real_distribution<double>(0.0, 1.0)(random); }
+
+    uint64_t sent_messages() const {
+        uint64_t sent = 0;
+        for (const Target &target: targets) sent += target.sent;
+        return sent;
+    }
+
+    std::string encode_next(Target &target) {
+        size_t length = options.min_size;
+        if (options.max_size > options.min_size) length += random() % (options.max_size - options.min_size + 1);
+        std::string text(length, ' ');
+        for (size_t i = 0; i < length; ++i) text[i] = static_cast<char>('a' + random() % 26);
+        int sequence_number = target.next_sequence++;
+        Message message(get_current_UTC_time(), text, peers.ports[target.peer], peers.ports[self], LOADGEN_TTL,
+                        options.binary_wire ? WIRE_BINARY_VERSION : LOADGEN_PROTOCOL_VERSION, 0,
+                        peers.locations[self], sequence_number, std::vector<ushort>{peers.ports[self]});
+        target.in_flight[sequence_number] = metrics_now_ns();
+        ++target.sent;
+        return message.encoded();
+    }
+
+    void queue_impaired(SendBatch &batch, std::deque<Deferred> &held, const sockaddr_in &address,
+                        const std::string &payload) {
+        if (chance() < options.loss) {
+            ++dropped;
+            return;
+        }
+        if (chance() < options.reorder) {
+            ++reordered;
+            Deferred deferred = {address, payload};
+            held.push_back(deferred);
+            return;
+        }
+        batch.add(address, payload.data(), payload.size());
+        ++sent_datagrams;
+        if (chance() < options.duplicate) {
+            ++duplicated;
+            batch.add(address, payload.data(), payload.size());
+            ++sent_datagrams;
+        }
+    }
+
+    size_t settle(Target &target, int sequence_number, uint64_t now_ns) {
+        auto found = target.in_flight.find(sequence_number);
+        if (found == target.in_flight.end()) return 0;
+        round_trip.record((now_ns - found->second) / 1000);
+        target.in_flight.erase(found);
+        ++target.acknowledged;
+        return 1;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    if (parse_load_options(argc, argv, options) != 0) return 1;
+
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, nullptr);
+    int signal_file_descriptor = signalfd(-1, &stop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    PeerTable peers(read_config(options.config_file_path));
+    int self = peers.index_of(options.listen_port);
+    if (self == NO_PEER) {
+        std::cerr << "Port not in config" << std::endl;
+        return 1;
+    }
+    LoadGenerator generator(options, peers, self);
+    if (!generator.valid_targets()) return 1;
+
+    int socket_file_descriptor = setup_listen_socket(options.listen_port);
+    ReceiveBatch receive_batch(RECEIVE_BATCH_CAPACITY, LOADGEN_BUFFER_SIZE);
+    EventLoop loop;
+    bool sending = true;
+    uint64_t started_ns = metrics_now_ns();
+    uint64_t send_ns = options.duration_s * 1000000000;
+
+    loop.watch(signal_file_descriptor, [&]() {
+        signalfd_siginfo info;
+        while (read(signal_file_descriptor, &info, sizeof(info)) > 0) {}
+        if (sending) send_ns = metrics_now_ns() - started_ns;
+        loop.stop();
+    });
+    loop.watch(socket_file_descriptor, [&]() {
+        int received;
+        do {
+            received = receive_batch.receive(socket_file_descriptor);
+            for (int i = 0; i < received; ++i) {
+                const ReceivedDatagram datagram = receive_batch.datagram(static_cast<size_t>(i));
+                if (datagram.truncated) continue;
+                if (!is_envelope(datagram.data, datagram.length)) {
+                    generator.receive(datagram.data, datagram.length);
+                    continue;
+                }
+                EnvelopeReader reader(datagram.data, datagram.length); // Drones may pack their ACKs
+                const char *packet;
+                size_t length;
+                while (reader.next(packet, length)) generator.receive(packet, length);
+            }
+        } while (received == static_cast<int>(receive_batch.capacity()));
+    });
+    loop.schedule_every(EVENT_LOOP_TICK_MS, [&]() { generator.send_due(sending); });
+    loop.schedule_after(options.duration_s * 1000, [&]() { sending = false; });
+    loop.schedule_after(options.duration_s * 1000 + options.drain_ms, [&]() { loop.stop(); });
+
+    generator.start();
+    loop.run();
+    generator.report(send_ns, metrics_now_ns() - started_ns);
+
+    close(signal_file_descriptor);
+    close(socket_file_descriptor);
+    close_send_socket();
+    return 0;
+}